@@ -63,7 +63,7 @@
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (ns clock if no TSC) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
@@ -10,6 +10,12 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#endif
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,8 +26,13 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES 0        /* Max cache size in bytes (0->detect LLC) */
+#define CACHE_BLOCK 0        /* Cache block size in bytes (0->detect) */
+#define FALLBACK_BYTES (1<<19) /* Used when the cache can't be detected */
+#define FALLBACK_BLOCK 32
+#define FLUSH_MAX (1<<26)    /* Never walk more than 64MB per sample */
+#define BOOTSTRAP_REPS 2000  /* Resamples for bootstrap intervals */
+#define BOOTSTRAP_LEVEL 0.95 /* Confidence level of those intervals */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -33,6 +44,9 @@ static int cache_block = CACHE_BLOCK;
 
 static int *cache_buf = NULL;
 
+static char *flush_lo = NULL;  /* if set, clflush this range instead */
+static size_t flush_len = 0;
+
 static double *values = NULL;
 static int samplecount = 0;
 
@@ -97,6 +111,91 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*
+ * sysfs_cache - Read the size (in bytes) of the largest data or unified
+ *     cache of CPU 0 and its line size from sysfs; 0 if unavailable
+ */
+static long sysfs_cache(long *line)
+{
+    char path[128], buf[32];
+    long best = 0, size;
+    int i, level, bestlevel = 0;
+    FILE *f;
+
+    for (i = 0; ; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+	if ((f = fopen(path, "r")) == NULL)
+	    break;
+	if (!fgets(buf, sizeof(buf), f))
+	    buf[0] = '\0';
+	fclose(f);
+	if (!strncmp(buf, "Instruction", 11))
+	    continue;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if ((f = fopen(path, "r")) == NULL)
+	    continue;
+	if (fscanf(f, "%d", &level) != 1)
+	    level = 0;
+	fclose(f);
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((f = fopen(path, "r")) == NULL)
+	    continue;
+	size = 0;
+	if (fscanf(f, "%ld%31s", &size, buf) == 2) {
+	    if (buf[0] == 'K')
+		size <<= 10;
+	    else if (buf[0] == 'M')
+		size <<= 20;
+	}
+	fclose(f);
+	if (level < bestlevel || size <= 0)
+	    continue;
+	bestlevel = level;
+	best = size;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/"
+		"index%d/coherency_line_size", i);
+	if ((f = fopen(path, "r")) != NULL) {
+	    if (fscanf(f, "%ld", line) != 1)
+		*line = 0;
+	    fclose(f);
+	}
+    }
+    return best;
+}
+
+/*
+ * detect_cache - Size the flush buffer to the last-level cache and 
+ *     stride it by the cache line size, unless they were set explicitly
+ */
+static void detect_cache(void)
+{
+    long bytes = 0, line = 0;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+    /* glibc answers these from CPUID on x86 */
+    if ((bytes = sysconf(_SC_LEVEL3_CACHE_SIZE)) <= 0 &&
+	(bytes = sysconf(_SC_LEVEL2_CACHE_SIZE)) <= 0)
+	bytes = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+    if (bytes <= 0 || line <= 0)
+	bytes = sysfs_cache(&line);
+
+    if (bytes <= 0)
+	bytes = FALLBACK_BYTES;
+    if (bytes > FLUSH_MAX)
+	bytes = FLUSH_MAX;
+    if (line <= 0 || line % sizeof(int))
+	line = FALLBACK_BLOCK;
+    if (cache_bytes == 0)
+	cache_bytes = bytes;
+    if (cache_block == 0)
+	cache_block = line;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -106,13 +205,19 @@ static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    int incr;
+
+    if (cache_bytes == 0 || cache_block == 0)
+	detect_cache();
+    incr = cache_block/sizeof(int);
     if (!cache_buf) {
 	cache_buf = malloc(cache_bytes);
 	if (!cache_buf) {
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Touch every page so the first sample doesn't pay for faults */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -123,6 +228,46 @@ static void clear()
     sink = x;
 }
 
+/*
+ * flush - Evict the lines of [flush_lo, flush_lo+flush_len) from every 
+ *     level of the cache. Falls back to clear() without clflush.
+ */
+static void flush()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    char *p, *end = flush_lo + flush_len;
+
+    if (cache_block == 0)
+	detect_cache();
+    for (p = flush_lo; p < end; p += cache_block)
+	_mm_clflush(p);
+    _mm_mfence();
+#else
+    clear();
+#endif
+}
+
+/*
+ * measure - Time a single run of f, honoring clear_cache and compensate
+ */
+static double measure(test_funct f, void *argp)
+{
+    if (clear_cache) {
+	if (flush_len)
+	    flush();
+	else
+	    clear();
+    }
+    if (compensate) {
+	start_comp_counter();
+	f(argp);
+	return get_comp_counter();
+    }
+    start_counter();
+    f(argp);
+    return get_counter();
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
@@ -130,27 +275,9 @@ double fcyc(test_funct f, void *argp)
 {
     double result;
     init_sampler();
-    if (compensate) {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_comp_counter();
-	    f(argp);
-	    cyc = get_comp_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    } else {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_counter();
-	    f(argp);
-	    cyc = get_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    }
+    do {
+	add_sample(measure(f, argp));
+    } while (!has_converged() && samplecount < maxsamples);
 #ifdef DEBUG
     {
 	int i;
@@ -168,6 +295,148 @@ double fcyc(test_funct f, void *argp)
 }
 
 
+/*************************************************************
+ * Sampling mode: rather than keeping only the K best samples,
+ * keep all of them and describe their distribution robustly.
+ ************************************************************/
+
+/*
+ * fcyc_samples - Run f warmup times untimed, then record the cycle 
+ *     counts of n timed runs in samples[0..n-1]
+ */
+void fcyc_samples(test_funct f, void *argp, int warmup, 
+		  double *samples, int n)
+{
+    int i;
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < n; i++)
+	samples[i] = measure(f, argp);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* 
+ * median - Median of v[0..n-1]; sorts v in place 
+ */
+static double median(double *v, int n)
+{
+    qsort(v, n, sizeof(double), cmp_double);
+    return (n % 2) ? v[n/2] : (v[n/2-1] + v[n/2]) / 2;
+}
+
+/* 
+ * Pseudo-random numbers for the bootstrap. A fixed seed keeps
+ * reports reproducible for a given set of samples. 
+ */
+static unsigned long long rng_state;
+
+static int rng_below(int n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (int)(rng_state % n);
+}
+
+/* 
+ * resample_median - Median of the n values v[idx[0]], ..., v[idx[n-1]]
+ */
+static double resample_median(double *v, int *idx, int n, double *scratch)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	scratch[i] = v[idx[i]];
+    return median(scratch, n);
+}
+
+/*
+ * bootstrap - Fill in the BOOTSTRAP_LEVEL confidence interval [*lo,*hi]
+ *     of median(a) - median(b), or of median(a) alone if b is NULL.
+ *     a[i] and b[i] were taken together, so each resample draws the
+ *     same indices from both to keep them paired.
+ */
+static void bootstrap(double *a, double *b, int n, double *lo, double *hi)
+{
+    double *stat, *scratch;
+    int *idx;
+    int i, j;
+
+    stat = malloc(BOOTSTRAP_REPS * sizeof(double));
+    scratch = malloc(n * sizeof(double));
+    idx = malloc(n * sizeof(int));
+    if (!stat || !scratch || !idx) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in bootstrap\n");
+	exit(1);
+    }
+    rng_state = 0x2545f4914f6cdd1dULL;
+    for (i = 0; i < BOOTSTRAP_REPS; i++) {
+	for (j = 0; j < n; j++)
+	    idx[j] = rng_below(n);
+	stat[i] = resample_median(a, idx, n, scratch);
+	if (b)
+	    stat[i] -= resample_median(b, idx, n, scratch);
+    }
+    qsort(stat, BOOTSTRAP_REPS, sizeof(double), cmp_double);
+    *lo = stat[(int)(BOOTSTRAP_REPS * (1 - BOOTSTRAP_LEVEL) / 2)];
+    *hi = stat[(int)(BOOTSTRAP_REPS * (1 + BOOTSTRAP_LEVEL) / 2) - 1];
+    free(stat);
+    free(scratch);
+    free(idx);
+}
+
+/*
+ * fcyc_summarize - Compute the median, median absolute deviation and
+ *     a bootstrap confidence interval for the median of n samples
+ */
+void fcyc_summarize(double *samples, int n, fcyc_stats_t *st)
+{
+    double *v = malloc(n * sizeof(double));
+    int i;
+
+    if (!v) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fcyc_summarize\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	v[i] = samples[i];
+    st->n = n;
+    st->median = median(v, n);
+    for (i = 0; i < n; i++)
+	v[i] = fabs(samples[i] - st->median);
+    st->mad = median(v, n);
+    bootstrap(samples, NULL, n, &st->lo, &st->hi);
+    free(v);
+}
+
+/*
+ * fcyc_compare - Compare two sets of n samples, taken interleaved so 
+ *     that drift affects both alike. Fills in *st with the difference
+ *     of their medians (a - b) and its confidence interval, and 
+ *     returns 1 if the interval excludes zero, i.e. the difference is
+ *     significant at BOOTSTRAP_LEVEL.
+ */
+int fcyc_compare(double *a, double *b, int n, fcyc_stats_t *st)
+{
+    fcyc_stats_t sa, sb;
+
+    fcyc_summarize(a, n, &sa);
+    fcyc_summarize(b, n, &sb);
+    st->n = n;
+    st->median = sa.median - sb.median;
+    st->mad = sa.mad > sb.mad ? sa.mad : sb.mad;
+    bootstrap(a, b, n, &st->lo, &st->hi);
+    return st->lo > 0 || st->hi < 0;
+}
+
+
 /*************************************************************
  * Set the various parameters used by the measurement routines 
  ************************************************************/
@@ -184,7 +453,7 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = size of the last-level cache, at most 64MB
  */
 void set_fcyc_cache_size(int bytes)
 {
@@ -199,12 +468,35 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size of the L1 data cache
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
 }
 
+/*
+ * set_fcyc_flush_range - When len > 0, clear the cache by flushing 
+ *     the lines of [lo, lo+len) with clflush rather than by walking 
+ *     a cache-sized buffer.
+ *     Default = NULL, 0
+ */
+void set_fcyc_flush_range(void *lo, size_t len)
+{
+    flush_lo = (char *)((unsigned long)lo & ~63UL);
+    flush_len = lo ? len + ((char *)lo - flush_lo) : 0;
+}
+
+/*
+ * get_fcyc_cache - Report the cache size and block size in use
+ */
+void get_fcyc_cache(int *bytes, int *block)
+{
+    if (cache_bytes == 0 || cache_block == 0)
+	detect_cache();
+    *bytes = cache_bytes;
+    *block = cache_block;
+}
+
 
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
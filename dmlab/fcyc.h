@@ -7,12 +7,37 @@
  *
  */
 
+#include <stddef.h>
+
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/*********************************************************
+ * Sampling mode: keep every sample rather than the K best
+ *********************************************************/
+
+/* Summary of a set of samples */
+typedef struct {
+    int n;          /* number of samples */
+    double median;  /* median sample */
+    double mad;     /* median absolute deviation from the median */
+    double lo, hi;  /* 95% bootstrap confidence interval of the median */
+} fcyc_stats_t;
+
+/* Run f warmup times, then record the cycles of n runs in samples */
+void fcyc_samples(test_funct f, void *argp, int warmup, 
+		  double *samples, int n);
+
+/* Compute median, MAD and confidence interval of n samples */
+void fcyc_summarize(double *samples, int n, fcyc_stats_t *st);
+
+/* Summarize median(a) - median(b) for two interleaved sets of n 
+   samples; return 1 if the difference is significant */
+int fcyc_compare(double *a, double *b, int n, fcyc_stats_t *st);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -26,16 +51,29 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = size of the last-level cache, at most 64MB
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size of the L1 data cache
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * set_fcyc_flush_range - When len > 0, clear the cache by flushing 
+ *     the lines of [lo, lo+len) with clflush rather than by walking 
+ *     a cache-sized buffer.
+ *     Default = NULL, 0
+ */
+void set_fcyc_flush_range(void *lo, size_t len);
+
+/*
+ * get_fcyc_cache - Report the cache size and block size in use
+ */
+void get_fcyc_cache(int *bytes, int *block);
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -30,6 +30,17 @@ void init_fsecs(void)
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
+    if (verbose) {
+	int bytes, block;
+	get_fcyc_cache(&bytes, &block);
+	printf("Clearing the cache with a %d KB buffer, %d-byte lines.\n",
+	       bytes >> 10, block);
+    }
+
+    /* Calibrate the compensated counter now, once, rather than in 
+       every worker process that mdriver -j forks */
+    start_comp_counter();
+    get_comp_counter();
 #elif USE_ITIMER
     if (verbose)
 	printf("Measuring performance with the interval timer.\n");
@@ -54,4 +65,41 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
+/*
+ * fsecs_samples - Run f warmup times untimed, then record the running 
+ *     time (in seconds) of each of n runs in samples[0..n-1]
+ */
+void fsecs_samples(fsecs_test_funct f, void *argp, int warmup,
+		   double *samples, int n)
+{
+    int i;
+
+#if USE_FCYC
+    fcyc_samples(f, argp, warmup, samples, n);
+    for (i = 0; i < n; i++)
+	samples[i] /= Mhz*1e6;
+#else
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < n; i++)
+#if USE_ITIMER
+	samples[i] = ftimer_itimer(f, argp, 1);
+#elif USE_GETTOD
+	samples[i] = ftimer_gettod(f, argp, 1);
+#endif
+#endif
+}
 
+/*
+ * fsecs_cache - Time later runs with a cold cache (the default) or a 
+ *     warm one. A cold cache is made by walking a buffer the size of 
+ *     the last-level cache or, if flush_len > 0, by flushing just the
+ *     lines of [flush_lo, flush_lo+flush_len).
+ */
+void fsecs_cache(int cold, void *flush_lo, size_t flush_len)
+{
+#if USE_FCYC
+    set_fcyc_clear_cache(cold);
+    set_fcyc_flush_range(flush_lo, flush_len);
+#endif
+}
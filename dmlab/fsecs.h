@@ -1,4 +1,9 @@
+#include <stddef.h>
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+void fsecs_samples(fsecs_test_funct f, void *argp, int warmup,
+		   double *samples, int n);
+void fsecs_cache(int cold, void *flush_lo, size_t flush_len);
@@ -0,0 +1,236 @@
+/*
+ * libmm.c - Put the package in mm.c behind the standard malloc
+ *     interface, so that it can run real programs:
+ *
+ *     unix> make libmm.so
+ *     unix> LD_PRELOAD=./libmm.so gcc -c foo.c
+ *
+ * The heap comes from memlib_mmap.c. One lock serializes every call,
+ * since mm.c is not thread safe.
+ *
+ * mm.c only aligns payloads to 8 bytes, but programs may count on
+ * the 16 bytes that glibc gives them, so malloc asks for alignment
+ * like memalign does. A block that had to be aligned further than
+ * mm_malloc placed it is marked by a tag in the word just before the
+ * returned pointer: the distance back to the payload that mm_malloc
+ * returned, with the 2 and 4 bits set. The word before a payload
+ * that mm_malloc returned is its block header, which holds a
+ * multiple of 8 plus the allocated bit, so the two can't be confused.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define MIN_ALIGN 16      /* what glibc guarantees on 64-bit machines */
+#define TAG_BITS  6       /* set in a tag, never in a block header */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+
+/*
+ * init - Set up the heap on the first call. Called with the lock held.
+ */
+static int init(void)
+{
+    if (!initialized) {
+	mem_init();
+	if (mm_init() < 0)
+	    return -1;
+	initialized = 1;
+    }
+    return 0;
+}
+
+/* Keep the lock consistent in the child of a fork */
+static void prepare(void) { pthread_mutex_lock(&lock); }
+static void release(void) { pthread_mutex_unlock(&lock); }
+
+__attribute__((constructor))
+static void libmm_init(void)
+{
+    pthread_atfork(prepare, release, release);
+}
+
+/* in_heap - Was p handed out by us? */
+static int in_heap(void *p)
+{
+    return initialized && (char *)p > (char *)mem_heap_lo() &&
+	(char *)p <= (char *)mem_heap_hi();
+}
+
+/* base - The payload that mm_malloc returned for user pointer p */
+static char *base(void *p)
+{
+    uintptr_t word = ((uintptr_t *)p)[-1];
+
+    if ((word & TAG_BITS) == TAG_BITS)
+	return (char *)p - (word & ~(uintptr_t)7);
+    return p;
+}
+
+/*
+ * aligned - Allocate size bytes aligned to align (a power of 2).
+ *     Called with the lock held.
+ */
+static void *aligned(size_t align, size_t size)
+{
+    char *raw, *p;
+
+    if (size == 0)
+	size = 1;
+    if (size > SIZE_MAX - align || init() < 0)
+	return NULL;
+    if ((raw = mm_malloc(size + align - 8)) == NULL)
+	return NULL;
+    p = (char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if (p != raw)
+	((uintptr_t *)p)[-1] = (uintptr_t)(p - raw) | TAG_BITS;
+    return p;
+}
+
+/* usable - Bytes of user pointer p that can be used */
+static size_t usable(void *p)
+{
+    return mm_usable_size(base(p)) - ((char *)p - base(p));
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&lock);
+    p = aligned(MIN_ALIGN, size);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+EXPORT void free(void *p)
+{
+    if (p == NULL)
+	return;
+    pthread_mutex_lock(&lock);
+    /* Blocks from before we were loaded are leaked, not corrupted */
+    if (in_heap(p))
+	mm_free(base(p));
+    pthread_mutex_unlock(&lock);
+}
+
+EXPORT void *realloc(void *p, size_t size)
+{
+    char *q, *newp;
+    size_t old;
+
+    if (p == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(p);
+	return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!in_heap(p)) {
+	/* Not ours; we can't know its size, so don't copy past it */
+	pthread_mutex_unlock(&lock);
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    /* Resize in place when the alignment allows it */
+    if (base(p) == p && (q = mm_realloc(p, size)) != NULL) {
+	if (((uintptr_t)q & (MIN_ALIGN - 1)) == 0) {
+	    pthread_mutex_unlock(&lock);
+	    return q;
+	}
+	p = q;
+    }
+    old = usable(p);
+    if ((newp = aligned(MIN_ALIGN, size)) != NULL) {
+	memcpy(newp, p, old < size ? old : size);
+	mm_free(base(p));
+    }
+    pthread_mutex_unlock(&lock);
+    if (newp == NULL)
+	errno = ENOMEM;
+    return newp;
+}
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+    void *p;
+
+    if (size && n > SIZE_MAX / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = malloc(n * size)) != NULL)
+	memset(p, 0, n * size);
+    return p;
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (align == 0 || (align & (align - 1))) {
+	errno = EINVAL;
+	return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    p = aligned(align < MIN_ALIGN ? MIN_ALIGN : align, size);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) || (align & (align - 1)))
+	return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *p)
+{
+    size_t n = 0;
+
+    if (p == NULL)
+	return 0;
+    pthread_mutex_lock(&lock);
+    if (in_heap(p))
+	n = usable(p);
+    pthread_mutex_unlock(&lock);
+    return n;
+}
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE      /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,11 +15,19 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 #include "mm.h"
+#include "mmabi.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "tstream.h"
+#include "report.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +38,10 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define WARMUP         2 /* untimed runs before taking samples (-s, -c) */
+#define COMPARE_SAMPLES 25 /* samples per package for -c without -s */
+#define REGRESSION_THRESHOLD 0.05 /* default for -T, as a fraction */
+#define CHECK_BLOCKS  64 /* blocks each mm_check_incr call may examine (-k) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
@@ -37,13 +50,23 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Shadow map of the heap with one bit per ALIGNMENT-byte granule. A
+ * bit is set iff some allocated payload covers that granule. Since
+ * payloads must start on a granule boundary, two payloads overlap
+ * exactly when they share a granule, so the map detects overlap in
+ * time proportional to the block size rather than the number of
+ * live blocks.
+ */
 typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned long *bits;   /* one bit per heap granule */
+    size_t nwords;         /* number of words in bits */
+    size_t hiword;         /* bits[hiword..nwords-1] are all zero */
 } range_t;
 
+/* Bits per word of the shadow map */
+#define RANGE_WORD_BITS (8 * sizeof(unsigned long))
+
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
     enum {ALLOC, FREE, REALLOC} type; /* type of request */
@@ -81,10 +104,31 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double avg_util; /* time-weighted average utilization (-u only) */
+
+    /* With -s, secs is the median sample and these describe the rest */
+    double mad;      /* median absolute deviation of the samples */
+    double lo, hi;   /* 95% confidence interval of the median */
+
+    double warm_secs; /* secs with a warm cache rather than a cold one (-w) */
+
+    /* Memory the util pass made resident, rather than merely reserved (-r) */
+    double touched;  /* bytes of heap pages touched */
+    long minflt;     /* minor page faults taken */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Summarizes one malloc package over the whole set of traces */
+typedef struct {
+    allocator_t *alloc; /* the package under test */
+    stats_t *stats;     /* one stats_t struct per tracefile */
+    int errors;         /* number of errors found in this package */
+    double util;        /* average space utilization */
+    double thruput;     /* average throughput in ops/sec */
+    double perfindex;   /* performance index (0 if there were errors) */
+} result_t;
+
 /********************
  * Global variables
  *******************/
@@ -95,6 +139,33 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* The malloc package currently under test */
+static allocator_t *mm;
+
+/* Samples per trace in sampling mode (-s), or 0 for the K-best scheme */
+static int nsamples = 0;
+
+/* Number of traces to evaluate at once in worker processes (-j) */
+static int jobs = 1;
+
+/* If nonzero, sample the utilization timeline every util_interval ops */
+static int util_interval = 0;
+
+/* If set, also time each trace with a warm cache (-w) */
+static int warm = 0;
+
+/* If set, make the cache cold by flushing just the heap (-F) */
+static int clflush_heap = 0;
+
+/* If set, report pages touched and minor faults per trace (-r) */
+static int resident = 0;
+
+/* If set, stream each trace from disk instead of loading it (-S) */
+static int stream = 0;
+
+/* If nonzero, run the package's incremental heap check every n ops (-k) */
+static int check_interval = 0;
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -105,14 +176,20 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the shadow map of payload extents */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
+static void remove_range(range_t **ranges, char *lo, int size);
 static void clear_ranges(range_t **ranges);
 
+/* these functions fill and verify payloads with an id-derived pattern */
+static unsigned long payload_pattern(int index);
+static void fill_payload(char *p, int lo, int hi, int index);
+static int check_payload(char *p, int size, int index);
+
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *read_trace_binary(char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -120,13 +197,33 @@ static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
+   of the malloc package under test (the student's mm.c by default) */
+static void eval_mm(result_t *result, trace_t **traces, char **tracefiles,
+		    int num_tracefiles);
+static void eval_mm_trace(trace_t *trace, int tracenum, char *tracefile,
+			  stats_t *stats);
+static void eval_mm_check(trace_t *trace, int tracenum, char *tracefile,
+			  stats_t *stats);
+static void eval_mm_time(trace_t *trace, stats_t *stats);
+static void eval_mm_parallel(result_t *result, trace_t **traces,
+			     char **tracefiles, int num_tracefiles);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   FILE *timeline, double *avg_util);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_samples(speed_t *speed_params, fcyc_stats_t *st);
+static void eval_mm_stream(char *tracefile, int tracenum, stats_t *stats);
+static int heap_ok(long opnum);
 
 /* Various helper routines */
+static FILE *open_timeline(allocator_t *a, int tracenum, char *filename);
 static void printresults(int n, stats_t *stats);
+static void perfindex(result_t *result, int n);
+static void printcompare(result_t *results, int n);
+static report_row_t *make_report(result_t *results, int num_allocs,
+				 char **tracefiles, int n, int *nrows);
+static void compare_speed(result_t *a, result_t *b, trace_t **traces,
+			  int num_tracefiles);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -141,24 +238,30 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    trace_t **traces = NULL;   /* every trace file, loaded once */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    result_t *results = NULL;  /* results for each malloc package */
+    int num_allocs = 1;        /* number of malloc packages (mm.c + -A) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
-
-    /* temporaries used to compute the performance index */
-    double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
-    int numcorrect;
+    int compare = 0;     /* If set, compare the last two packages (-c) */
+    char *report = NULL;   /* If set, write the results here (-o) */
+    char *baseline = NULL; /* If set, compare with these results (-B) */
+    double threshold = REGRESSION_THRESHOLD; /* for -B (-T) */
+    int status = 0;        /* exit status; 2 if -B found regressions */
+
+    /* The built-in mm.c package is always evaluated first */
+    if ((results = (result_t *)calloc(1, sizeof(result_t))) == NULL)
+	unix_error("results calloc in main failed");
+    results[0].alloc = mmabi_builtin();
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:u:A:j:s:o:B:T:k:cwFrShvVgal")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,6 +281,59 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'u': /* Sample the utilization timeline every n ops */
+	    util_interval = atoi(optarg);
+	    if (util_interval <= 0)
+		app_error("ERROR: -u requires a positive number of ops");
+	    break;
+	case 'j': /* Evaluate this many traces at once */
+	    jobs = atoi(optarg);
+	    if (jobs <= 0)
+		app_error("ERROR: -j requires a positive number of jobs");
+	    break;
+	case 's': /* Take this many samples per trace instead of K-best */
+	    nsamples = atoi(optarg);
+	    if (nsamples <= 0)
+		app_error("ERROR: -s requires a positive number of samples");
+	    break;
+	case 'c': /* Compare the speed of the last two packages */
+	    compare = 1;
+	    break;
+	case 'w': /* Report warm-cache as well as cold-cache timings */
+	    warm = 1;
+	    break;
+	case 'F': /* Flush the heap with clflush instead of walking the LLC */
+	    clflush_heap = 1;
+	    break;
+	case 'r': /* Report resident heap pages and minor faults */
+	    resident = 1;
+	    break;
+	case 'S': /* Stream traces from disk rather than loading them */
+	    stream = 1;
+	    break;
+	case 'o': /* Write the results to a .json or .csv file */
+	    report = optarg;
+	    break;
+	case 'B': /* Compare the results with a report from an earlier run */
+	    baseline = optarg;
+	    break;
+	case 'T': /* Percent change that counts as a regression */
+	    threshold = atof(optarg) / 100;
+	    if (threshold <= 0)
+		app_error("ERROR: -T requires a positive percentage");
+	    break;
+	case 'k': /* Check part of the heap every n ops */
+	    check_interval = atoi(optarg);
+	    if (check_interval <= 0)
+		app_error("ERROR: -k requires a positive number of ops");
+	    break;
+	case 'A': /* Also evaluate the malloc package in a shared object */
+	    results = realloc(results, (num_allocs+1) * sizeof(result_t));
+	    if (results == NULL)
+		unix_error("ERROR: realloc failed in main");
+	    memset(&results[num_allocs], 0, sizeof(result_t));
+	    results[num_allocs++].alloc = mmabi_load(optarg);
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
@@ -235,6 +391,16 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Read every trace once; all the packages replay the same copies */
+    traces = (trace_t **)calloc(num_tracefiles, sizeof(trace_t *));
+    if (traces == NULL)
+	unix_error("traces calloc in main failed");
+    if (stream && (run_libc || compare || nsamples || warm || jobs > 1 ||
+		   util_interval || resident))
+	app_error("ERROR: -S can't be combined with -l, -c, -s, -w, -j, -u or -r");
+    for (i=0; i < num_tracefiles && !stream; i++)
+	traces[i] = read_trace(tracedir, tracefiles[i]);
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -252,18 +418,16 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    libc_stats[i].ops = traces[i]->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
+	    libc_stats[i].valid = eval_libc_valid(traces[i], i);
 	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
+		speed_params.trace = traces[i];
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
 	    }
-	    free_trace(trace);
 	}
 
 	/* Display the libc results in a compact table */
@@ -273,116 +437,176 @@ int main(int argc, char **argv)
 	}
     }
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    /*
+     * Always run and evaluate the student's mm package, followed by
+     * any packages loaded with -A
+     */
+    for (i=0; i < num_allocs; i++) {
+	eval_mm(&results[i], traces, tracefiles, num_tracefiles);
+
+	/* Display the mm results in a compact table */
+	if (verbose) {
+	    printf("\nResults for %s malloc:\n", results[i].alloc->name);
+	    printresults(num_tracefiles, results[i].stats);
+	    printf("\n");
 	}
-	free_trace(trace);
-    }
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
+	/* Compute and print the performance index */
+	perfindex(&results[i], num_tracefiles);
+	if (num_allocs > 1)
+	    printf("%s: ", results[i].alloc->name);
+	if (results[i].errors == 0) {
+	    printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+		   UTIL_WEIGHT * results[i].util * 100,
+		   results[i].perfindex - UTIL_WEIGHT * results[i].util * 100,
+		   results[i].perfindex);
+	}
+	else { /* There were errors */
+	    printf("Terminated with %d errors\n", results[i].errors);
+	}
     }
 
-    /* 
-     * Accumulate the aggregate statistics for the student's mm package 
-     */
-    secs = 0;
-    ops = 0;
-    util = 0;
-    numcorrect = 0;
-    for (i=0; i < num_tracefiles; i++) {
-	secs += mm_stats[i].secs;
-	ops += mm_stats[i].ops;
-	util += mm_stats[i].util;
-	if (mm_stats[i].valid)
-	    numcorrect++;
+    /* Put the packages side by side */
+    if (num_allocs > 1)
+	printcompare(results, num_allocs);
+    if (compare) {
+	if (num_allocs < 2)
+	    app_error("ERROR: -c needs a package to compare against (-A)");
+	compare_speed(&results[num_allocs-2], &results[num_allocs-1], 
+		      traces, num_tracefiles);
     }
-    avg_mm_util = util/num_tracefiles;
 
-    /* 
-     * Compute and print the performance index 
-     */
-    if (errors == 0) {
-	avg_mm_throughput = ops/secs;
-
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+    /* Write a machine-readable report and check it against a baseline */
+    if (report || baseline) {
+	report_row_t *rows, *base;
+	int nrows, nbase;
+
+	rows = make_report(results, num_allocs, tracefiles, num_tracefiles,
+			   &nrows);
+	if (report)
+	    report_write(report, rows, nrows);
+	if (baseline) {
+	    base = report_read(baseline, &nbase);
+	    if (report_compare(base, nbase, rows, nrows, threshold) > 0)
+		status = 2;
+	    free(base);
 	}
-	
-	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
-	
-    }
-    else { /* There were errors */
-	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
+	free(rows);
     }
 
     if (autograder) {
+	int numcorrect = 0;
+	for (i=0; i < num_tracefiles; i++)
+	    if (results[0].stats[i].valid)
+		numcorrect++;
 	printf("correct:%d\n", numcorrect);
-	printf("perfidx:%.0f\n", perfindex);
+	printf("perfidx:%.0f\n", results[0].perfindex);
     }
 
-    exit(0);
+    for (i=0; i < num_tracefiles; i++)
+	if (traces[i])
+	    free_trace(traces[i]);
+    exit(status);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the shadow map, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * shadow map to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/*
+ * range_span - Compute the first and last granule covered by the 
+ *     payload [lo, lo+size-1], relative to the start of the heap.
+ */
+static void range_span(char *lo, int size, size_t *first, size_t *last)
+{
+    size_t off = (size_t)(lo - (char *)mem_heap_lo());
+
+    *first = off / ALIGNMENT;
+    *last = (off + size - 1) / ALIGNMENT;
+}
+
+/*
+ * range_mask - Mask of the bits [lo, hi] (inclusive) within one word
+ */
+static unsigned long range_mask(size_t lo, size_t hi)
+{
+    unsigned long ones = ~0UL;
+
+    ones <<= lo;
+    if (hi + 1 < RANGE_WORD_BITS)
+	ones &= (1UL << (hi + 1)) - 1;
+    return ones;
+}
+
+/*
+ * range_test_and_set - If none of the granules [first, last] are in 
+ *     use, mark them all and return 1. Otherwise leave the map alone 
+ *     and return 0.
+ */
+static int range_test_and_set(range_t *r, size_t first, size_t last)
+{
+    size_t w, w0 = first / RANGE_WORD_BITS, w1 = last / RANGE_WORD_BITS;
+    unsigned long m0, m1, any = 0;
+
+    if (w0 == w1) {
+	m0 = range_mask(first % RANGE_WORD_BITS, last % RANGE_WORD_BITS);
+	if (r->bits[w0] & m0)
+	    return 0;
+	r->bits[w0] |= m0;
+    }
+    else {
+	m0 = range_mask(first % RANGE_WORD_BITS, RANGE_WORD_BITS - 1);
+	m1 = range_mask(0, last % RANGE_WORD_BITS);
+	any = (r->bits[w0] & m0) | (r->bits[w1] & m1);
+	for (w = w0 + 1; w < w1; w++)
+	    any |= r->bits[w];
+	if (any)
+	    return 0;
+	r->bits[w0] |= m0;
+	for (w = w0 + 1; w < w1; w++)
+	    r->bits[w] = ~0UL;
+	r->bits[w1] |= m1;
+    }
+    if (w1 >= r->hiword)
+	r->hiword = w1 + 1;
+    return 1;
+}
+
+/*
+ * range_clear - Mark the granules [first, last] as no longer in use
+ */
+static void range_clear(range_t *r, size_t first, size_t last)
+{
+    size_t w, w0 = first / RANGE_WORD_BITS, w1 = last / RANGE_WORD_BITS;
+
+    if (w0 == w1) {
+	r->bits[w0] &= ~range_mask(first % RANGE_WORD_BITS, 
+				   last % RANGE_WORD_BITS);
+	return;
+    }
+    r->bits[w0] &= ~range_mask(first % RANGE_WORD_BITS, RANGE_WORD_BITS - 1);
+    for (w = w0 + 1; w < w1; w++)
+	r->bits[w] = 0;
+    r->bits[w1] &= ~range_mask(0, last % RANGE_WORD_BITS);
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we mark the granules of its payload in the shadow map. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    size_t first, last;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -405,64 +629,127 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    if (*ranges == NULL)
+	clear_ranges(ranges);
+    range_span(lo, size, &first, &last);
+    if (!range_test_and_set(*ranges, first, last)) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload\n", lo, hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
-
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
-     */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
- *
- * size removed because it's not used (RBull 18May2018)
+ * remove_range - Clear the shadow map for the block of size bytes 
+ *     whose payload starts at lo 
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(range_t **ranges, char *lo, int size)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    // int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            // size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    size_t first, last;
+
+    if (*ranges == NULL || size <= 0)
+	return;
+    range_span(lo, size, &first, &last);
+    range_clear(*ranges, first, last);
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - Empty the shadow map for a new trace, allocating it
+ *     on first use. Only the words touched by the last trace are reset.
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *r = *ranges;
+
+    if (r == NULL) {
+	if ((r = (range_t *)malloc(sizeof(range_t))) == NULL)
+	    unix_error("malloc error in clear_ranges");
+	r->nwords = (MAX_HEAP / ALIGNMENT + RANGE_WORD_BITS - 1) / 
+	    RANGE_WORD_BITS;
+	if ((r->bits = calloc(r->nwords, sizeof(unsigned long))) == NULL)
+	    unix_error("calloc error in clear_ranges");
+	r->hiword = 0;
+	*ranges = r;
+	return;
+    }
+    memset(r->bits, 0, r->hiword * sizeof(unsigned long));
+    r->hiword = 0;
+}
+
+/*********************************************************************
+ * The following routines fill each payload with a pattern derived
+ * from its trace id and later verify it. They work a word at a time
+ * (payloads are ALIGNMENT-byte aligned) and are written as simple
+ * loops over independent words so that the compiler vectorizes them.
+ ********************************************************************/
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+/*
+ * payload_pattern - The word used to fill the payload of block index.
+ *     Every byte depends on the id, so stale or shifted data from a
+ *     neighbouring block is caught, not just data from the same id.
+ */
+static unsigned long payload_pattern(int index)
+{
+    unsigned long x = (unsigned long)index + 0x9e3779b97f4a7c15UL;
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * fill_payload - Fill bytes [lo, hi) of payload p with the pattern 
+ *     for index. The pattern is laid out relative to p, so a partial
+ *     fill lines up with an earlier fill of the same block.
+ */
+static void fill_payload(char *p, int lo, int hi, int index)
+{
+    unsigned long pat = payload_pattern(index);
+    unsigned long *w;
+    int i, wlo, whi;
+
+    if (lo >= hi)
+	return;
+
+    /* Bytes before the first whole word */
+    wlo = (lo + sizeof(long) - 1) / sizeof(long);
+    whi = hi / sizeof(long);
+    if (wlo > whi) {
+	memcpy(p + lo, (char *)&pat + lo % sizeof(long), hi - lo);
+	return;
     }
-    *ranges = NULL;
+    memcpy(p + lo, (char *)&pat + lo % sizeof(long), 
+	   wlo * sizeof(long) - lo);
+
+    /* Whole words */
+    w = (unsigned long *)p;
+    for (i = wlo; i < whi; i++)
+	w[i] = pat;
+
+    /* Bytes after the last whole word */
+    memcpy(p + whi * sizeof(long), &pat, hi - whi * sizeof(long));
+}
+
+/*
+ * check_payload - Return 1 if the first size bytes of payload p still
+ *     hold the pattern for index, 0 otherwise.
+ */
+static int check_payload(char *p, int size, int index)
+{
+    unsigned long pat = payload_pattern(index);
+    unsigned long *w = (unsigned long *)p;
+    unsigned long diff = 0;
+    int i, nwords = size / sizeof(long);
+
+    /* Accumulate differences without branching in the loop body */
+    for (i = 0; i < nwords; i++)
+	diff |= w[i] ^ pat;
+    if (diff)
+	return 0;
+
+    return memcmp(p + nwords * sizeof(long), &pat, 
+		  size - nwords * sizeof(long)) == 0;
 }
 
 
@@ -497,6 +784,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }    
+    if (fread(&index, sizeof(index), 1, tracefile) == 1 &&
+	index == TSTREAM_MAGIC) {
+	fclose(tracefile);
+	free(trace);
+	return read_trace_binary(path);
+    }
+    rewind(tracefile);
     if (fscanf(tracefile, "%d %d %d %d",
 	   &(trace->sugg_heapsize),  /* not used */
 	   &(trace->num_ids),     
@@ -570,6 +864,55 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * read_trace_binary - read_trace for a trace in the binary format 
+ *    of tstream.h
+ */
+static trace_t *read_trace_binary(char *path)
+{
+    tstream_t *ts;
+    tstream_hdr_t *hdr;
+    tstream_op_t *ops;
+    trace_t *trace;
+    int i, n, op_index = 0;
+    unsigned max_index = 0;
+
+    ts = tstream_open(path);
+    hdr = tstream_header(ts);
+    if (hdr->num_ops > INT_MAX || hdr->num_ids > INT_MAX) {
+	sprintf(msg, "%s is too large to load; try -S", path);
+	app_error(msg);
+    }
+    if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL ||
+	(trace->ops = malloc(hdr->num_ops * sizeof(traceop_t))) == NULL ||
+	(trace->blocks = malloc(hdr->num_ids * sizeof(char *))) == NULL ||
+	(trace->block_sizes = malloc(hdr->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in read_trace_binary");
+    trace->sugg_heapsize = 0;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+
+    while ((n = tstream_next(ts, &ops)) > 0) {
+	if (op_index + n > trace->num_ops) {
+	    printf("Too many requests in tracefile %s\n", path);
+	    exit(1);
+	}
+	for (i = 0; i < n; i++, op_index++) {
+	    trace->ops[op_index].type = TS_TYPE(&ops[i]) == TS_ALLOC ? ALLOC :
+		TS_TYPE(&ops[i]) == TS_REALLOC ? REALLOC : FREE;
+	    trace->ops[op_index].index = TS_ID(&ops[i]);
+	    trace->ops[op_index].size = ops[i].size;
+	    if (TS_ID(&ops[i]) > max_index)
+		max_index = TS_ID(&ops[i]);
+	}
+    }
+    tstream_close(ts);
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    return trace;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
@@ -588,11 +931,259 @@ void free_trace(trace_t *trace)
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm - Evaluate the package result->alloc on every trace using 
+ *    the K-best scheme, filling in result->stats and result->errors
+ */
+static void eval_mm(result_t *result, trace_t **traces, char **tracefiles,
+		    int num_tracefiles)
+{
+    int i;
+    stats_t *stats;
+
+    mm = result->alloc;
+    errors = 0;
+    if (verbose > 1)
+	printf("\nTesting %s malloc\n", mm->name);
+
+    /* Allocate the stats array, with one stats_t struct per tracefile */
+    stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (stats == NULL)
+	unix_error("stats calloc in eval_mm failed");
+    result->stats = stats;
+
+    if (jobs > 1 && num_tracefiles > 1 && !stream) {
+	eval_mm_parallel(result, traces, tracefiles, num_tracefiles);
+	return;
+    }
+    for (i=0; i < num_tracefiles; i++)
+	if (stream)
+	    eval_mm_stream(tracefiles[i], i, &stats[i]);
+	else
+	    eval_mm_trace(traces[i], i, tracefiles[i], &stats[i]);
+    result->errors = errors;
+}
+
+/*
+ * eval_mm_trace - Check correctness, then measure utilization and 
+ *    throughput of the package under test on one trace
+ */
+static void eval_mm_trace(trace_t *trace, int tracenum, char *tracefile,
+			  stats_t *stats)
+{
+    eval_mm_check(trace, tracenum, tracefile, stats);
+    if (stats->valid)
+	eval_mm_time(trace, stats);
+}
+
+/*
+ * eval_mm_check - The untimed passes over one trace: check 
+ *    correctness and measure utilization
+ */
+static void eval_mm_check(trace_t *trace, int tracenum, char *tracefile,
+			  stats_t *stats)
+{
+    static range_t *ranges = NULL; /* keeps track of block extents */
+    FILE *timeline = NULL;     /* utilization timeline for one trace (-u) */
+
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	if (util_interval)
+	    timeline = open_timeline(mm, tracenum, tracefile);
+	if (resident) {
+	    struct rusage before, after;
+
+	    /* Start from an untouched heap so only this pass counts */
+	    mem_release_pages();
+	    getrusage(RUSAGE_SELF, &before);
+	    stats->util = eval_mm_util(trace, tracenum, &ranges, timeline,
+				       &stats->avg_util);
+	    getrusage(RUSAGE_SELF, &after);
+	    stats->minflt = after.ru_minflt - before.ru_minflt;
+	    stats->touched = (double)mem_resident_pages() * mem_pagesize();
+	}
+	else
+	    stats->util = eval_mm_util(trace, tracenum, &ranges, timeline,
+				       &stats->avg_util);
+	if (timeline) {
+	    fclose(timeline);
+	    timeline = NULL;
+	    printf("trace %d: util %.0f%% at peak, %.0f%% averaged "
+		   "over time\n", tracenum, stats->util*100.0, 
+		   stats->avg_util*100.0);
+	}
+    }
+}
+
+/*
+ * eval_mm_time - Measure the throughput of the package under test on
+ *    a trace that it has passed
+ */
+static void eval_mm_time(trace_t *trace, stats_t *stats)
+{
+    speed_t speed_params;      /* input parameters to eval_mm_speed */ 
+    fcyc_stats_t st;           /* summary of the samples (-s) */
+
+    speed_params.trace = trace;
+    speed_params.ranges = NULL;
+    if (verbose > 1)
+	printf("and performance.\n");
+
+    /* The heap grows back to its current size on every replay */
+    if (clflush_heap)
+	fsecs_cache(1, mem_heap_lo(), mem_heapsize());
+    if (nsamples) {
+	eval_mm_samples(&speed_params, &st);
+	stats->secs = st.median;
+	stats->mad = st.mad;
+	stats->lo = st.lo;
+	stats->hi = st.hi;
+    }
+    else
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+
+    /* Warm timings are sampled the same way as cold ones */
+    if (warm) {
+	fsecs_cache(0, NULL, 0);
+	if (nsamples) {
+	    eval_mm_samples(&speed_params, &st);
+	    stats->warm_secs = st.median;
+	}
+	else
+	    stats->warm_secs = fsecs(eval_mm_speed, &speed_params);
+    }
+    fsecs_cache(1, NULL, 0);
+}
+
+/*
+ * eval_mm_parallel - Like eval_mm, but check up to jobs traces at a 
+ *    time, each in a worker process with its own copy of the heap and
+ *    pinned to its own CPU. Each worker sends its stats_t and error 
+ *    count back through a pipe. Once every worker is done, the traces 
+ *    that passed are timed here, one at a time, so a timed run never
+ *    overlaps any other work, and a package that crashes or exits in 
+ *    a worker can't leave the others waiting on it.
+ */
+static void eval_mm_parallel(result_t *result, trace_t **traces,
+			     char **tracefiles, int num_tracefiles)
+{
+    int i, j, running = 0, next = 0, status, ncpus = 0;
+    int *fds;
+    pid_t pid, *pids;
+    cpu_set_t allowed, mine;
+    int *cpus, *slot_cpu, *slot_of;
+
+    /* The CPUs we may run on; worker slot k gets the k-th of them */
+    if ((cpus = calloc(CPU_SETSIZE, sizeof(int))) == NULL ||
+	(slot_cpu = calloc(jobs, sizeof(int))) == NULL ||
+	(slot_of = calloc(num_tracefiles, sizeof(int))) == NULL ||
+	(fds = calloc(num_tracefiles, sizeof(int))) == NULL ||
+	(pids = calloc(num_tracefiles, sizeof(pid_t))) == NULL)
+	unix_error("calloc failed in eval_mm_parallel");
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+	for (i = 0; i < CPU_SETSIZE; i++)
+	    if (CPU_ISSET(i, &allowed))
+		cpus[ncpus++] = i;
+    for (j = 0; j < jobs; j++)
+	slot_cpu[j] = -1;
+
+    fflush(stdout);
+    while (next < num_tracefiles || running > 0) {
+	/* Start workers while there are free slots */
+	while (running < jobs && next < num_tracefiles) {
+	    int pfd[2];
+
+	    for (j = 0; slot_cpu[j] != -1; j++)
+		;
+	    slot_cpu[j] = ncpus ? cpus[j % ncpus] : 0;
+	    slot_of[next] = j;
+	    if (pipe(pfd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pid == 0) {
+		stats_t st;
+
+		close(pfd[0]);
+		if (ncpus) {
+		    CPU_ZERO(&mine);
+		    CPU_SET(slot_cpu[j], &mine);
+		    sched_setaffinity(0, sizeof(mine), &mine);
+		}
+		memset(&st, 0, sizeof(st));
+		eval_mm_check(traces[next], next, tracefiles[next], &st);
+		fflush(stdout);
+		if (write(pfd[1], &st, sizeof(st)) != sizeof(st) ||
+		    write(pfd[1], &errors, sizeof(errors)) != sizeof(errors))
+		    _exit(1);
+		_exit(0);
+	    }
+	    close(pfd[1]);
+	    fds[next] = pfd[0];
+	    pids[next] = pid;
+	    next++;
+	    running++;
+	}
+
+	/* Collect a worker that has finished */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_mm_parallel");
+	for (i = 0; i < next && pids[i] != pid; i++)
+	    ;
+	if (i == next)
+	    continue;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+	    read(fds[i], &result->stats[i], sizeof(stats_t)) 
+	    != sizeof(stats_t) ||
+	    read(fds[i], &j, sizeof(j)) != sizeof(j)) {
+	    malloc_error(i, 0, "worker process failed");
+	    result->stats[i].ops = traces[i]->num_ops;
+	    result->stats[i].valid = 0;
+	}
+	else
+	    errors += j;
+	close(fds[i]);
+	pids[i] = 0;
+	slot_cpu[slot_of[i]] = -1;
+	running--;
+    }
+
+    /* Time the traces that passed, now that no worker is running */
+    for (i = 0; i < num_tracefiles; i++)
+	if (result->stats[i].valid) {
+	    speed_t speed_params;
+
+	    /* -F flushes the heap, so grow it to this trace's size first */
+	    if (clflush_heap) {
+		speed_params.trace = traces[i];
+		speed_params.ranges = NULL;
+		eval_mm_speed(&speed_params);
+	    }
+	    eval_mm_time(traces[i], &result->stats[i]);
+	}
+    result->errors = errors;
+
+    free(cpus);
+    free(slot_cpu);
+    free(slot_of);
+    free(fds);
+    free(pids);
+}
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness. Every
+ *    payload must be aligned, lie within the heap, and not overlap any
+ *    other payload. Each payload is filled with a pattern derived from
+ *    its id, which must survive intact until the block is freed, and
+ *    whose prefix must be carried over by realloc.
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i;
     int index;
     int size;
     int oldsize;
@@ -600,12 +1191,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and empty the shadow map */
     mem_reset_brk();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -620,25 +1211,26 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = mm->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the shadow map if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
 	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
+	    /* 
+	     * Fill the payload with the pattern for this id. It is checked
+	     * when the block is freed or realloc'd, which catches both
+	     * allocator metadata written into a live payload and data
+	     * that realloc failed to copy.
 	     */
-	    memset(p, index & 0xFF, size);
+	    fill_payload(p, 0, size, index);
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
@@ -647,35 +1239,39 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case REALLOC: /* mm_realloc */
 	    
-	    /* Call the student's realloc */
+	    /* The old payload must be intact before we hand it back */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    oldsize = trace->block_sizes[index];
+	    if (!check_payload(oldp, oldsize, index)) {
+		malloc_error(tracenum, i, "payload was modified while "
+			     "allocated (detected before mm_realloc)");
+		return 0;
+	    }
+
+	    /* Call the student's realloc */
+	    if ((newp = mm->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
+	    /* Remove the old region from the shadow map */
+	    remove_range(ranges, oldp, oldsize);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to the shadow map */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
-	    /* ADDED: cgw
+	    /*
 	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
+	     * block and then extend the pattern over the rest of the block
 	     */
-	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	    if (!check_payload(newp, oldsize, index)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
-	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    fill_payload(newp, oldsize, size, index);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -684,16 +1280,25 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Check the payload, remove region and call student's free */
 	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (!check_payload(p, trace->block_sizes[index], index)) {
+		malloc_error(tracenum, i, "payload was modified while "
+			     "allocated (detected at mm_free)");
+		return 0;
+	    }
+	    remove_range(ranges, p, trace->block_sizes[index]);
+	    mm->free(p);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	if (!heap_ok(i + 1)) {
+	    malloc_error(tracenum, i, "mm_check_incr found a bad heap.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -709,11 +1314,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   If timeline is not NULL, we also write a CSV row with the live 
+ *   bytes, heap size and free block count every util_interval ops, 
+ *   and return in *avg_util the ratio of live bytes to heap size 
+ *   averaged over every op of the trace. 
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   FILE *timeline, double *avg_util)
 {   
     int i;
+    double util_sum = 0;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -723,7 +1334,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -733,7 +1344,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -755,7 +1366,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -776,7 +1387,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -788,9 +1399,20 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Record the timeline, which costs nothing when disabled */
+	if (timeline) {
+	    util_sum += (double)total_size / (double)mm->heapsize();
+	    if (i % util_interval == 0 || i == trace->num_ops - 1)
+		fprintf(timeline, "%d,%d,%lu,%d\n", i, total_size,
+			(unsigned long)mm->heapsize(), 
+			mm->freeblocks ? mm->freeblocks() : -1);
+	}
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    if (timeline)
+	*avg_util = util_sum / trace->num_ops;
+    return ((double)max_total_size / (double)mm->heapsize());
 }
 
 
@@ -806,7 +1428,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (mm->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -816,7 +1438,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -825,7 +1447,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -833,7 +1455,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm->free(block);
             break;
 
 	default:
@@ -841,6 +1463,221 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_samples - Sampling mode (-s): after WARMUP untimed runs, 
+ *    time nsamples runs of eval_mm_speed and summarize them in st: the
+ *    median, its spread and its confidence interval, which are 
+ *    reported instead of the K-best minimum
+ */
+static void eval_mm_samples(speed_t *speed_params, fcyc_stats_t *st)
+{
+    double *samples;
+
+    if ((samples = (double *)malloc(nsamples * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_samples");
+    fsecs_samples(eval_mm_speed, speed_params, WARMUP, samples, nsamples);
+    fcyc_summarize(samples, nsamples, st);
+    free(samples);
+}
+
+/*
+ * heap_ok - With -k, run the package's incremental heap check after
+ *    every check_interval ops, opnum being the number done so far.
+ *    Each call looks at no more than CHECK_BLOCKS blocks, so the cost
+ *    per op stays bounded however large the heap grows. Packages
+ *    without mm_check_incr always pass.
+ */
+static int heap_ok(long opnum)
+{
+    if (!check_interval || mm->check == NULL || opnum % check_interval)
+	return 1;
+    return mm->check(CHECK_BLOCKS) == 0;
+}
+
+/*
+ * eval_mm_stream - Streaming mode (-S): check, measure utilization
+ *    and time the package under test in a single pass over a trace 
+ *    that is read from disk in chunks as it is replayed. Only the 
+ *    replay of each chunk is timed, not any wait for the next one, 
+ *    and only the blocks that are live are remembered. The checks 
+ *    are limited to alignment and heap bounds; use a normal run to 
+ *    check for overlap and payload corruption.
+ */
+static void eval_mm_stream(char *tracefile, int tracenum, stats_t *stats)
+{
+    static livemap_t live;
+    char path[MAXLINE];
+    tstream_t *ts;
+    tstream_op_t *ops;
+    live_t *e;
+    char *p = NULL;
+    int i, n, size;
+    long opnum = 0;
+    double total_size = 0, max_total_size = 0, secs = 0;
+    struct timespec t0, t1;
+
+    if (live.slots == NULL)
+	live_init(&live);
+    live_clear(&live);
+    snprintf(path, sizeof(path), "%s%s", tracedir, tracefile);
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", path);
+    ts = tstream_open(path);
+
+    mem_reset_brk();
+    if (mm->init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    while ((n = tstream_next(ts, &ops)) > 0) {
+	/* Keep the driver's own mallocs out of the timed loop */
+	live_reserve(&live, live.n + n);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++, opnum++) {
+	    size = ops[i].size;
+	    switch (TS_TYPE(&ops[i])) {
+
+	    case TS_ALLOC:
+		if ((e = live_insert(&live, TS_ID(&ops[i]))) == NULL) {
+		    malloc_error(tracenum, opnum, "id allocated twice.");
+		    goto out;
+		}
+		p = mm->malloc(size);
+		e->p = p;
+		e->size = size;
+		total_size += size;
+		break;
+
+	    case TS_REALLOC:
+		if ((e = live_find(&live, TS_ID(&ops[i]))) == NULL) {
+		    malloc_error(tracenum, opnum, "realloc of a freed id.");
+		    goto out;
+		}
+		p = mm->realloc(e->p, size);
+		total_size += size - (double)e->size;
+		e->p = p;
+		e->size = size;
+		break;
+
+	    case TS_FREE:
+		if ((e = live_find(&live, TS_ID(&ops[i]))) == NULL) {
+		    malloc_error(tracenum, opnum, "free of a freed id.");
+		    goto out;
+		}
+		mm->free(e->p);
+		total_size -= e->size;
+		live_remove(&live, e);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream");
+	    }
+
+	    /* Cheap checks of the block just allocated */
+	    if (TS_TYPE(&ops[i]) != TS_FREE) {
+		if (p == NULL) {
+		    malloc_error(tracenum, opnum, 
+				 "mm_malloc or mm_realloc failed.");
+		    goto out;
+		}
+		if (!IS_ALIGNED(p) || p < (char *)mem_heap_lo() ||
+		    p + size - 1 > (char *)mem_heap_hi()) {
+		    malloc_error(tracenum, opnum, 
+				 "Payload misaligned or outside the heap.");
+		    goto out;
+		}
+		if (total_size > max_total_size)
+		    max_total_size = total_size;
+	    }
+
+	    if (!heap_ok(opnum + 1)) {
+		malloc_error(tracenum, opnum, "mm_check_incr found a bad heap.");
+		goto out;
+	    }
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+
+    if (opnum != tstream_header(ts)->num_ops) {
+	malloc_error(tracenum, opnum, "trace ended early.");
+	goto out;
+    }
+    stats->valid = 1;
+    stats->ops = opnum;
+    stats->secs = secs;
+    stats->util = max_total_size / mm->heapsize();
+    if (verbose > 1)
+	printf("%lu chunks of %d requests waited for the disk\n",
+	       tstream_stalls(ts), TSTREAM_CHUNK);
+ out:
+    tstream_close(ts);
+}
+
+/*
+ * compare_speed - Compare mode (-c): time packages a and b on each 
+ *    trace with their runs interleaved, so that drift in the machine
+ *    affects both alike, and report whether the difference between 
+ *    their median times is significant. The order of each pair of 
+ *    runs alternates, so neither package always runs right after the
+ *    other has warmed the caches.
+ */
+static void compare_speed(result_t *a, result_t *b, trace_t **traces,
+			  int num_tracefiles)
+{
+    int i, k, j, signif, n = nsamples ? nsamples : COMPARE_SAMPLES;
+    double *sa, *sb;
+    char ci[32];
+    fcyc_stats_t st, ma, mb;
+    speed_t speed_params;
+
+    /* The packages' heaps differ in size, so never clflush just one */
+    fsecs_cache(1, NULL, 0);
+    sa = (double *)malloc(n * sizeof(double));
+    sb = (double *)malloc(n * sizeof(double));
+    if (sa == NULL || sb == NULL)
+	unix_error("malloc failed in compare_speed");
+
+    printf("\nSpeed of %s relative to %s (%d interleaved samples each):\n",
+	   a->alloc->name, b->alloc->name, n);
+    printf("%5s%12s%12s%9s%20s%7s\n", 
+	   "trace", "secs(a)", "secs(b)", "a-b", "95% CI", "signif");
+    for (i = 0; i < num_tracefiles; i++) {
+	if (!a->stats[i].valid || !b->stats[i].valid) {
+	    printf("%5d%12s%12s%9s%20s%7s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	speed_params.trace = traces[i];
+	for (k = 0; k < n; k++)
+	    for (j = 0; j < 2; j++) {
+		/* a then b on even samples, b then a on odd ones */
+		if ((j ^ k) & 1) {
+		    mm = b->alloc;
+		    fsecs_samples(eval_mm_speed, &speed_params, 
+				  k ? 0 : WARMUP, &sb[k], 1);
+		}
+		else {
+		    mm = a->alloc;
+		    fsecs_samples(eval_mm_speed, &speed_params, 
+				  k ? 0 : WARMUP, &sa[k], 1);
+		}
+	    }
+	fcyc_summarize(sa, n, &ma);
+	fcyc_summarize(sb, n, &mb);
+	signif = fcyc_compare(sa, sb, n, &st);
+
+	/* Differences are shown relative to b's median */
+	snprintf(ci, sizeof(ci), "[%.1f%%, %.1f%%]", 
+		 100.0 * st.lo / mb.median, 100.0 * st.hi / mb.median);
+	printf("%5d%12.6f%12.6f%8.1f%%%20s%7s\n", i,
+	       ma.median, mb.median, 100.0 * st.median / mb.median, ci,
+	       signif ? "yes" : "no");
+    }
+    free(sa);
+    free(sb);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -942,17 +1779,34 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (warm)
+	printf("%10s%6s", "warm secs", "Kops");
+    if (resident)
+	printf("%10s%8s", "touchedKB", "minflt");
+    if (nsamples)
+	printf("%7s%24s", "mad", "95% CI of secs");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (warm)
+		printf("%10.6f%6.0f", stats[i].warm_secs,
+		       (stats[i].ops/1e3)/stats[i].warm_secs);
+	    if (resident)
+		printf("%10.0f%8ld", stats[i].touched/1024, stats[i].minflt);
+	    if (nsamples && stats[i].secs > 0)
+		printf("%6.1f%%  [%.6f, %.6f]", 
+		       100.0 * stats[i].mad / stats[i].secs, 
+		       stats[i].lo, stats[i].hi);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -988,6 +1842,164 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * basename_noext - Copy the last component of path, without its 
+ *     extension, into buf
+ */
+static void basename_noext(char *buf, size_t len, char *path)
+{
+    char *base = strrchr(path, '/');
+    char *dot;
+
+    base = base ? base + 1 : path;
+    snprintf(buf, len, "%s", base);
+    if ((dot = strrchr(buf, '.')) != NULL)
+	*dot = '\0';
+}
+
+/*
+ * open_timeline - Create the utilization timeline CSV for a tracefile.
+ *     The file is named after the trace and its index, so that traces 
+ *     with the same name in different directories don't collide, and 
+ *     placed in the current directory, e.g. trace 0, amptjp-bal.rep ->
+ *     amptjp-bal.0.util.csv. Packages loaded with -A add their own 
+ *     name: amptjp-bal.0.mm_seg.util.csv
+ */
+static FILE *open_timeline(allocator_t *a, int tracenum, char *filename)
+{
+    char path[MAXLINE];
+    char label[MAXLINE/2];
+    FILE *fp;
+
+    basename_noext(path, MAXLINE/2, filename);
+    sprintf(path + strlen(path), ".%d", tracenum);
+    if (a != mmabi_builtin()) {
+	basename_noext(label, sizeof(label) - 10, a->name);
+	strcat(path, ".");
+	strcat(path, label);
+    }
+    strcat(path, ".util.csv");
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in open_timeline", path);
+	unix_error(msg);
+    }
+    fprintf(fp, "op,live_bytes,heap_bytes,free_blocks\n");
+    return fp;
+}
+
+/*
+ * perfindex - Compute the average utilization, throughput and the
+ *     performance index of one package over n traces
+ */
+static void perfindex(result_t *result, int n)
+{
+    int i;
+    double secs = 0, ops = 0, util = 0, p1, p2;
+
+    for (i=0; i < n; i++) {
+	secs += result->stats[i].secs;
+	ops += result->stats[i].ops;
+	util += result->stats[i].util;
+    }
+    result->util = util/n;
+    result->thruput = 0;
+    result->perfindex = 0;
+    if (result->errors)
+	return;
+
+    result->thruput = ops/secs;
+    p1 = UTIL_WEIGHT * result->util;
+    if (result->thruput > AVG_LIBC_THRUPUT) {
+	p2 = (double)(1.0 - UTIL_WEIGHT);
+    } 
+    else {
+	p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+	    (result->thruput/AVG_LIBC_THRUPUT);
+    }
+    result->perfindex = (p1 + p2)*100.0;
+}
+
+/*
+ * make_report - Collect the results of every package into report 
+ *    rows: one per trace, then a "total" row
+ */
+static report_row_t *make_report(result_t *results, int num_allocs,
+				 char **tracefiles, int n, int *nrows)
+{
+    report_row_t *rows, *row;
+    stats_t *st;
+    int a, i;
+
+    *nrows = num_allocs * (n + 1);
+    if ((rows = calloc(*nrows, sizeof(report_row_t))) == NULL)
+	unix_error("calloc failed in make_report");
+    for (a = 0, row = rows; a < num_allocs; a++) {
+	for (i = 0; i < n; i++, row++) {
+	    st = &results[a].stats[i];
+	    snprintf(row->package, REPORT_NAMELEN, "%s", 
+		     results[a].alloc->name);
+	    snprintf(row->trace, REPORT_NAMELEN, "%s", tracefiles[i]);
+	    if (!(row->valid = st->valid))
+		continue;
+	    row->util = st->util;
+	    row->avg_util = st->avg_util;
+	    row->ops = st->ops;
+	    row->secs = st->secs;
+	    if (st->secs > 0) {
+		row->kops = st->ops / 1e3 / st->secs;
+		row->ns_per_op = st->secs * 1e9 / st->ops;
+	    }
+	    row->mad = st->mad;
+	    row->ci_lo = st->lo;
+	    row->ci_hi = st->hi;
+	    row->warm_secs = st->warm_secs;
+	    row->touched_kb = st->touched / 1024;
+	    row->minflt = st->minflt;
+	}
+
+	/* The totals are only defined if every trace was valid */
+	snprintf(row->package, REPORT_NAMELEN, "%s", results[a].alloc->name);
+	strcpy(row->trace, "total");
+	if ((row->valid = (results[a].errors == 0))) {
+	    row->util = results[a].util;
+	    row->kops = results[a].thruput / 1e3;
+	    row->ns_per_op = 1e9 / results[a].thruput;
+	    for (i = 0; i < n; i++) {
+		row->ops += results[a].stats[i].ops;
+		row->secs += results[a].stats[i].secs;
+		row->warm_secs += results[a].stats[i].warm_secs;
+		row->touched_kb += results[a].stats[i].touched / 1024;
+		row->minflt += results[a].stats[i].minflt;
+	    }
+	    row->perfindex = results[a].perfindex;
+	}
+	row++;
+    }
+    return rows;
+}
+
+/*
+ * printcompare - prints the packages evaluated in this run side by side
+ */
+static void printcompare(result_t *results, int n)
+{
+    int i;
+
+    printf("\nComparison of malloc packages:\n");
+    printf("%-24s%6s%10s%7s\n", "package", "util", "Kops", "perf");
+    for (i=0; i < n; i++) {
+	if (results[i].errors == 0)
+	    printf("%-24s%5.0f%%%10.0f%7.0f\n",
+		   results[i].alloc->name,
+		   results[i].util*100.0,
+		   results[i].thruput/1e3,
+		   results[i].perfindex);
+	else
+	    printf("%-24s%6s%10s%7s\n", results[i].alloc->name, 
+		   "-", "-", "-");
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1020,14 +2032,29 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcwFrS] [-f <file>] [-t <dir>] [-u <n>] [-j <n>]\n"
+	    "               [-s <n>] [-k <n>] [-o <report>] [-B <report> [-T <pct>]]\n"
+	    "               [-A <lib.so>]...\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A <lib.so> Also evaluate the malloc package in <lib.so>.\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <file>  Flag regressions against an earlier -o report.\n");
+    fprintf(stderr, "\t-c         Compare the speed of the last two packages.\n");
+    fprintf(stderr, "\t-F         Make the cache cold by flushing only the heap.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate <n> traces at once in worker processes.\n");
+    fprintf(stderr, "\t-k <n>     Check part of the heap every <n> ops (timed with -S).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-o <file>  Write the results to <file> (.json or .csv).\n");
+    fprintf(stderr, "\t-r         Report heap pages touched and minor faults.\n");
+    fprintf(stderr, "\t-S         Stream traces from disk; one timed pass each.\n");
+    fprintf(stderr, "\t-s <n>     Report median and spread of <n> samples per trace.\n");
+    fprintf(stderr, "\t-T <pct>   Change that counts as a regression (default 5).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-u <n>     Write a utilization timeline sampled every <n> ops.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w         Also time each trace with a warm cache.\n");
 }
@@ -24,9 +24,15 @@ static char *mem_max_addr;   /* largest legal heap address */
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* 
+     * Map the storage we will use to model the available VM. Pages 
+     * become resident only when the allocator first touches them, 
+     * which is what mem_resident_pages measures.
+     */
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
@@ -39,7 +45,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, MAX_HEAP);
 }
 
 /*
@@ -50,6 +56,40 @@ void mem_reset_brk()
     mem_brk = mem_start_brk;
 }
 
+/*
+ * mem_release_pages - give every page of the heap back to the kernel, 
+ *    so that the next pages touched start out as zero-fill faults
+ */
+void mem_release_pages(void)
+{
+    if (madvise(mem_start_brk, MAX_HEAP, MADV_DONTNEED) < 0) {
+	fprintf(stderr, "mem_release_pages: madvise error\n");
+	exit(1);
+    }
+}
+
+/*
+ * mem_resident_pages - return the number of heap pages that are 
+ *    resident, i.e. touched since the last mem_release_pages
+ */
+size_t mem_resident_pages(void)
+{
+    static unsigned char *vec = NULL;
+    size_t i, n, pages = MAX_HEAP / mem_pagesize();
+
+    if (vec == NULL && (vec = malloc(pages)) == NULL) {
+	fprintf(stderr, "mem_resident_pages: malloc error\n");
+	exit(1);
+    }
+    if (mincore(mem_start_brk, MAX_HEAP, vec) < 0) {
+	fprintf(stderr, "mem_resident_pages: mincore error\n");
+	exit(1);
+    }
+    for (i = n = 0; i < pages; i++)
+	n += vec[i] & 1;
+    return n;
+}
+
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
@@ -8,4 +8,6 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_release_pages(void);
+size_t mem_resident_pages(void);
 
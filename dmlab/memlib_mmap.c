@@ -0,0 +1,120 @@
+/*
+ * memlib_mmap.c - memlib for libmm.so, where the heap is real memory
+ *     for a real program rather than a fixed buffer in mdriver
+ *
+ * The heap is a large reservation of address space with no access;
+ * mem_sbrk makes it readable and writable a chunk at a time as the
+ * break moves up, so only the part in use counts against the system.
+ * The size of the reservation can be set with LIBMM_HEAP (in MB).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+
+#include "memlib.h"
+
+#define RESERVE_MB  (1 << 15)   /* default reservation: 32GB */
+#define GROW_CHUNK  (1 << 20)   /* mprotect this much at a time */
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_rw_end;     /* end of the readable, writable part */
+static char *mem_max_addr;   /* largest legal heap address */
+
+/*
+ * mem_init - reserve the address space for the heap
+ */
+void mem_init(void)
+{
+    char *env = getenv("LIBMM_HEAP");
+    size_t size = (size_t)(env ? atol(env) : RESERVE_MB) << 20;
+
+    mem_start_brk = mmap(NULL, size, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init: mmap error\n");
+	exit(1);
+    }
+    mem_max_addr = mem_start_brk + size;
+    mem_brk = mem_rw_end = mem_start_brk;
+}
+
+/*
+ * mem_deinit - give the heap back to the system
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk, mem_max_addr - mem_start_brk);
+}
+
+/*
+ * mem_reset_brk - reset the break to make an empty heap
+ */
+void mem_reset_brk()
+{
+    mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - Extends the heap by incr bytes and returns the start
+ *    address of the new area, which is zero-filled the first time
+ */
+void *mem_sbrk(int incr)
+{
+    char *old_brk = mem_brk;
+    size_t grow;
+
+    if ((incr < 0) || (incr > mem_max_addr - mem_brk)) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    if (mem_brk + incr > mem_rw_end) {
+	grow = (mem_brk + incr - mem_rw_end + GROW_CHUNK - 1) &
+	    ~(size_t)(GROW_CHUNK - 1);
+	if (grow > (size_t)(mem_max_addr - mem_rw_end))
+	    grow = mem_max_addr - mem_rw_end;
+	if (mprotect(mem_rw_end, grow, PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    return (void *)-1;
+	}
+	mem_rw_end += grow;
+    }
+    mem_brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo()
+{
+    return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi()
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize()
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize()
+{
+    return (size_t)getpagesize();
+}
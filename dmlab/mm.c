@@ -47,6 +47,7 @@ team_t team = {
 char *base;
 char *top;
 char *search;  // use to implement next_fit
+char *cursor;  // where the next mm_check_incr call resumes
 
 
 /*
@@ -137,6 +138,7 @@ int mm_init(void) {
 
   // initialize search pointer to free block
   search = base;
+  cursor = base;
 
   return 0;
 }
@@ -205,7 +207,9 @@ void *mm_malloc(size_t size) {
     }
 
     // extend heap by blocksize
-    mem_sbrk(blocksize);
+    if (mem_sbrk(blocksize) == (void*)(-1)) {
+      return NULL;
+    }
     top += blocksize;
   } else { // compute excess space in selected block
     blocksize = block_size(p);
@@ -255,13 +259,94 @@ void mm_free(void *p) {
   mark_block(bp, size, 0);
 
   search = bp;
+
+  // the checker's cursor may have been a block boundary we merged away
+  if (cursor > bp && cursor < bp + size) {
+    cursor = bp;
+  }
 }
 
 
-// ignore --- included for compatibility with test suite
+// resize memory, in place when the block or its free neighbor has room
 void *mm_realloc(void *p, size_t newsize) {
-  // omitted Spring 2020
-  return NULL;
+  char *bp, *next, *newp;
+  size_t size, totalsize, avail, excess;
+
+  if (p == NULL) {
+    return mm_malloc(newsize);
+  }
+  if (newsize == 0) {
+    mm_free(p);
+    return NULL;
+  }
+
+  bp = block_pointer(p);
+  size = block_size(bp);
+  totalsize = adjusted_size(newsize);
+  next = bp + size;
+
+  // the last block can grow by extending the heap
+  if (next >= top && size < totalsize) {
+    if (mem_sbrk(totalsize - size) == (void*)(-1)) {
+      return NULL;
+    }
+    top += totalsize - size;
+    mark_block(bp, totalsize, 1);
+    return p;
+  }
+
+  // take in the next block if it is free; merging it also keeps
+  // a shrunk block's leftover from sitting next to a free block
+  avail = size;
+  if (next < top && !is_allocated(next)) {
+    avail += block_size(next);
+  }
+  if (avail < totalsize) {
+    newp = mm_malloc(newsize);
+    if (newp == NULL) {
+      return NULL;
+    }
+    memcpy(newp, p, payload_size(size));
+    mm_free(p);
+    return newp;
+  }
+
+  // split off the excess as mm_malloc does
+  excess = avail - totalsize;
+  if (excess <= 2 * WORD_SIZE + MIN_PAYLOAD) {
+    mark_block(bp, avail, 1);
+  } else {
+    mark_block(bp, totalsize, 1);
+    mark_block(bp + totalsize, excess, 0);
+  }
+
+  // the search and checker pointers may have pointed into the block
+  // we took in
+  if (search > bp && search < bp + avail) {
+    search = bp;
+  }
+  if (cursor > bp && cursor < bp + avail) {
+    cursor = bp;
+  }
+  return p;
+}
+
+
+// return the number of payload bytes usable in allocated block p
+size_t mm_usable_size(void *p) {
+  return payload_size(block_size(block_pointer(p)));
+}
+
+
+// count the free blocks in the heap (used by the driver's -u timeline)
+int mm_freeblocks(void) {
+  int count = 0;
+  char *p;
+
+  for (p = base; p < top; p += block_size(p)) {
+    if (!is_allocated(p)) count++;
+  }
+  return count;
 }
 
 
@@ -297,3 +382,54 @@ int mm_check(void) {
 
   return result;
 }
+
+
+// check one block's boundary tags, size and alignment, and that it
+// ends at or below the top
+static int check_block(char *p) {
+  size_t blocksize = block_size(p);
+
+  if (blocksize < 2 * WORD_SIZE + MIN_PAYLOAD || blocksize % ALIGNMENT
+      || p + blocksize > top) {
+    printf("bad block size %zu at %p!\n", blocksize, p);
+    return -1;
+  }
+  if ((size_t)payload_pointer(p) % ALIGNMENT) {
+    printf("misaligned payload at %p!\n", p);
+    return -1;
+  }
+  if (*header_pointer(p) != *footer_pointer(p, blocksize)) {
+    printf("tags differ at %p!\n", p);
+    return -1;
+  }
+  return 0;
+}
+
+
+// check at most budget blocks, starting where the last call stopped,
+// so that the heap can be checked often without walking all of it.
+// The cursor goes back to base after the last block; the blocks are
+// also the free list, so every call checks the one next_fit resumes at
+int mm_check_incr(int budget) {
+  int result = 0;
+  char *p = cursor;
+
+  // search must be a block boundary or the top
+  if (search < base || search > top ||
+      (search < top && check_block(search) < 0)) {
+    printf("bad search pointer %p!\n", search);
+    result = -1;
+  }
+
+  while (budget-- > 0 && p < top) {
+    if (check_block(p) < 0) {
+      // sizes can't be trusted any more, so start the next lap over
+      cursor = base;
+      return -1;
+    }
+    p += block_size(p);
+  }
+  cursor = (p == top) ? base : p;
+
+  return result;
+}
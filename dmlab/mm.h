@@ -5,6 +5,14 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Optional instrumentation. A package that doesn't define these still
+ * links; the driver checks for a null address before calling them.
+ */
+extern int mm_freeblocks(void) __attribute__((weak)); /* # free blocks */
+extern size_t mm_usable_size(void *ptr) __attribute__((weak)); /* payload */
+extern int mm_check_incr(int budget) __attribute__((weak)); /* -k checks */
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
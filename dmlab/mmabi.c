@@ -0,0 +1,76 @@
+/*
+ * mmabi.c - Build allocator_t tables for the malloc packages that 
+ *           mdriver evaluates (see mmabi.h)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "mmabi.h"
+#include "mm.h"
+#include "memlib.h"
+
+/*
+ * mmabi_builtin - return the table for the package in mm.c
+ */
+allocator_t *mmabi_builtin(void)
+{
+    static allocator_t builtin;
+
+    builtin.name = "mm";
+    builtin.init = mm_init;
+    builtin.malloc = mm_malloc;
+    builtin.free = mm_free;
+    builtin.realloc = mm_realloc;
+    builtin.heapsize = mem_heapsize;
+    builtin.freeblocks = mm_freeblocks; /* weak, so possibly NULL */
+    builtin.check = mm_check_incr;      /* likewise */
+    return &builtin;
+}
+
+/*
+ * lookup - find a symbol in a loaded package, exiting if it is 
+ *     required but missing
+ */
+static void *lookup(void *handle, char *path, char *symbol, int required)
+{
+    void *addr = dlsym(handle, symbol);
+
+    if (addr == NULL && required) {
+	fprintf(stderr, "ERROR: %s does not define %s\n", path, symbol);
+	exit(1);
+    }
+    return addr;
+}
+
+/*
+ * mmabi_load - load a package from a shared object
+ */
+allocator_t *mmabi_load(char *path)
+{
+    void *handle;
+    allocator_t *a;
+
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	fprintf(stderr, "ERROR: could not load %s: %s\n", path, dlerror());
+	exit(1);
+    }
+    if ((a = (allocator_t *)malloc(sizeof(allocator_t))) == NULL) {
+	fprintf(stderr, "mmabi_load: malloc error\n");
+	exit(1);
+    }
+
+    a->name = strdup(path);
+    a->init = (int (*)(void))lookup(handle, path, "mm_init", 1);
+    a->malloc = (void *(*)(size_t))lookup(handle, path, "mm_malloc", 1);
+    a->free = (void (*)(void *))lookup(handle, path, "mm_free", 1);
+    a->realloc = (void *(*)(void *, size_t))
+	lookup(handle, path, "mm_realloc", 1);
+    a->heapsize = (size_t (*)(void))lookup(handle, path, "mm_heapsize", 0);
+    if (a->heapsize == NULL)
+	a->heapsize = mem_heapsize;
+    a->freeblocks = (int (*)(void))lookup(handle, path, "mm_freeblocks", 0);
+    a->check = (int (*)(int))lookup(handle, path, "mm_check_incr", 0);
+    return a;
+}
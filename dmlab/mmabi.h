@@ -0,0 +1,38 @@
+/*
+ * mmabi.h - The interface between mdriver and a malloc package
+ *
+ * Each package under test is described by a table of function 
+ * pointers, so that the driver can evaluate the package linked into 
+ * mdriver (mm.c) side by side with any number of packages loaded 
+ * from shared objects.
+ */
+#ifndef __MMABI_H_
+#define __MMABI_H_
+
+#include <stddef.h>
+
+typedef struct {
+    char *name;                            /* label used in the results */
+    int (*init)(void);                     /* mm_init */
+    void *(*malloc)(size_t size);          /* mm_malloc */
+    void (*free)(void *ptr);               /* mm_free */
+    void *(*realloc)(void *ptr, size_t size); /* mm_realloc */
+    size_t (*heapsize)(void);              /* heap size in bytes */
+    int (*freeblocks)(void);               /* # free blocks, or NULL */
+    int (*check)(int budget);              /* check <= budget blocks, or NULL */
+} allocator_t;
+
+/* The package in mm.c that is linked into the driver */
+allocator_t *mmabi_builtin(void);
+
+/* 
+ * Load a package from the shared object at path. The object must 
+ * define mm_init, mm_malloc, mm_free and mm_realloc, and may define 
+ * mm_heapsize, mm_freeblocks and mm_check_incr. It gets its memory 
+ * from the memlib functions exported by the driver, so it must be 
+ * linked with -Bsymbolic to keep its own mm_* references from binding 
+ * to mm.c.
+ */
+allocator_t *mmabi_load(char *path);
+
+#endif /* __MMABI_H_ */
@@ -0,0 +1,332 @@
+/*
+ * mtrace.c - Record the malloc requests of an unmodified program
+ *
+ * Build libmtrace.so and preload it:
+ *
+ *     unix> MTRACE_FILE=gcc.log LD_PRELOAD=./libmtrace.so gcc ...
+ *     unix> ./mtrace2rep -b gcc.log > traces/gcc.rep
+ *
+ * Each thread appends records to its own buffer and writes the whole
+ * buffer with a single write() when it fills, when the thread exits,
+ * and when the process exits, so the threads of the traced program 
+ * only share the counter that orders their requests. The log goes to
+ * $MTRACE_FILE, or mtrace.<pid>.log by default. Child processes, 
+ * forked or exec'd, log to $MTRACE_FILE.<pid> (or mtrace.<pid>.log) 
+ * instead of clobbering their parent's log. The real allocator is 
+ * reached through glibc's __libc_* entry points, which never call 
+ * back into malloc.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mtrace.h"
+
+/* Records per thread buffer (1 MB) */
+#define MTRACE_BUFRECS (1 << 15)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+/* A thread's buffer of records not yet written */
+typedef struct mtrace_buf {
+    mtrace_chunk_t hdr;          /* written just before recs */
+    mtrace_rec_t recs[MTRACE_BUFRECS];
+    struct mtrace_buf *next;     /* all live buffers, for exit and fork */
+} mtrace_buf_t;
+
+static uint64_t seq = 0;          /* next sequence number */
+static int log_fd = -1;           /* the log file */
+static pid_t log_pid = 0;         /* process that opened log_fd */
+static int done = 0;              /* set once the final flush starts */
+static mtrace_buf_t *bufs = NULL; /* list of live buffers */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* for bufs */
+static pthread_key_t key;         /* runs thread_exit per thread */
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* Static TLS, so that touching it never allocates */
+static __thread mtrace_buf_t *mybuf 
+    __attribute__((tls_model("initial-exec")));
+static __thread int busy __attribute__((tls_model("initial-exec")));
+
+/*
+ * init - Remember which process was started with the interposer, so
+ *     that its exec'd children can tell they are not it
+ */
+static void __attribute__((constructor)) init(void)
+{
+    char pid[32];
+
+    busy = 1;
+    if (getenv("MTRACE_ROOT") == NULL) {
+	snprintf(pid, sizeof(pid), "%d", (int)getpid());
+	setenv("MTRACE_ROOT", pid, 1);
+    }
+    busy = 0;
+}
+
+/*
+ * open_log - Open the log for the current process
+ */
+static void open_log(void)
+{
+    char path[256];
+    char *env = getenv("MTRACE_FILE");
+    char *root = getenv("MTRACE_ROOT");
+
+    log_pid = getpid();
+    if (env && root && atoi(root) == (int)log_pid)
+	snprintf(path, sizeof(path), "%s", env);
+    else if (env)
+	snprintf(path, sizeof(path), "%s.%d", env, (int)log_pid);
+    else
+	snprintf(path, sizeof(path), "mtrace.%d.log", (int)log_pid);
+    if (log_fd >= 0)
+	close(log_fd);
+    log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (log_fd < 0)
+	fprintf(stderr, "mtrace: could not open %s: %s\n", path, 
+		strerror(errno));
+}
+
+/*
+ * flush - Write out the records in buffer b as one chunk
+ */
+static void flush(mtrace_buf_t *b)
+{
+    size_t len = sizeof(mtrace_chunk_t) + b->hdr.count * sizeof(mtrace_rec_t);
+    char *p = (char *)&b->hdr;
+    ssize_t n;
+
+    if (b->hdr.count == 0)
+	return;
+    if (log_pid != getpid())
+	open_log();
+    while (len > 0 && log_fd >= 0) {
+	if ((n = write(log_fd, p, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	p += n;
+	len -= n;
+    }
+    b->hdr.count = 0;
+}
+
+/*
+ * thread_exit - Flush and release the buffer of an exiting thread
+ */
+static void thread_exit(void *arg)
+{
+    mtrace_buf_t *b = arg, **pp;
+
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    flush(b);
+    for (pp = &bufs; *pp; pp = &(*pp)->next)
+	if (*pp == b) {
+	    *pp = b->next;
+	    break;
+	}
+    pthread_mutex_unlock(&lock);
+    munmap(b, sizeof(mtrace_buf_t));
+    mybuf = NULL;
+    busy = 0;
+}
+
+/*
+ * fork_child - In a new child, forget the parent's other threads and
+ *     the records the parent will write itself
+ */
+static void fork_child(void)
+{
+    pthread_mutex_init(&lock, NULL);
+    bufs = mybuf;
+    if (mybuf) {
+	mybuf->next = NULL;
+	mybuf->hdr.count = 0;
+    }
+}
+
+static void fork_prepare(void) { pthread_mutex_lock(&lock); }
+static void fork_parent(void) { pthread_mutex_unlock(&lock); }
+
+static void init_once(void)
+{
+    pthread_key_create(&key, thread_exit);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/*
+ * get_buf - Return the calling thread's buffer, creating it on first use
+ */
+static mtrace_buf_t *get_buf(void)
+{
+    mtrace_buf_t *b;
+
+    if (mybuf)
+	return mybuf;
+    pthread_once(&once, init_once);
+    b = mmap(NULL, sizeof(mtrace_buf_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+	return NULL;
+    b->hdr.magic = MTRACE_MAGIC;
+    b->hdr.count = 0;
+    pthread_mutex_lock(&lock);
+    if (log_fd < 0)
+	open_log();
+    b->next = bufs;
+    bufs = b;
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(key, b);
+    mybuf = b;
+    return b;
+}
+
+/*
+ * next_seq - Take the next sequence number
+ */
+static uint64_t next_seq(void)
+{
+    return __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * record_at - Append one request with sequence number n to the 
+ *     calling thread's buffer
+ */
+static void record_at(uint64_t n, int type, void *ptr, void *old, size_t size)
+{
+    mtrace_buf_t *b;
+    mtrace_rec_t *r;
+
+    if (busy || done)
+	return;
+    busy = 1;
+    if ((b = get_buf()) != NULL) {
+	r = &b->recs[b->hdr.count++];
+	r->seq = n | ((uint64_t)type << MT_SEQ_BITS);
+	r->ptr = (uint64_t)ptr;
+	r->old = (uint64_t)old;
+	r->size = size;
+	if (b->hdr.count == MTRACE_BUFRECS)
+	    flush(b);
+    }
+    busy = 0;
+}
+
+/*
+ * record - Append one request to the calling thread's buffer
+ */
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    record_at(next_seq(), type, ptr, old, size);
+}
+
+/*
+ * fini - Write out every thread's remaining records at exit
+ */
+static void __attribute__((destructor)) fini(void)
+{
+    mtrace_buf_t *b;
+
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    done = 1;
+    for (b = bufs; b; b = b->next)
+	flush(b);
+    pthread_mutex_unlock(&lock);
+}
+
+/*****************************************************************
+ * The interposed functions. A block is recorded after the real 
+ * allocator returns it and a free is recorded before the block is 
+ * handed back, so the sequence numbers respect the order in which
+ * threads can observe a pointer. realloc does both: the block it is
+ * given may be handed to another thread before it returns, so it is
+ * given up (MT_REALLOC) at a sequence number taken before the call, 
+ * and the block returned is taken (MT_REALLOC_END) at one taken after.
+ ****************************************************************/
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (p)
+	record(MT_MALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (p)
+	record(MT_CALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    uint64_t before;
+    void *p;
+
+    if (old == NULL)
+	return malloc(size);
+    before = next_seq();
+    p = __libc_realloc(old, size);
+    if (p || size == 0)
+	record_at(before, MT_REALLOC, p, old, size);
+    if (p)
+	record(MT_REALLOC_END, p, old, size);
+    return p;
+}
+
+void free(void *p)
+{
+    if (p)
+	record(MT_FREE, p, NULL, 0);
+    __libc_free(p);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p = __libc_memalign(align, size);
+
+    if (p)
+	record(MT_MALLOC, p, NULL, size);
+    return p;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+int posix_memalign(void **pp, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) || (align & (align - 1)))
+	return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+	return ENOMEM;
+    *pp = p;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
@@ -0,0 +1,42 @@
+/*
+ * mtrace.h - Binary log format written by the libmtrace.so malloc 
+ *     interposer and read by mtrace2rep
+ *
+ * The log is a sequence of chunks, each a header followed by the 
+ * records one thread buffered since its last flush. Chunks from 
+ * different threads interleave in the file, so the records carry a 
+ * process-wide sequence number that gives the order of the requests.
+ */
+#ifndef __MTRACE_H_
+#define __MTRACE_H_
+
+#include <stdint.h>
+
+#define MTRACE_MAGIC 0x3152544dU /* "MTR1" */
+
+/* Request types */
+#define MT_MALLOC  1  /* ptr = malloc(size), also the memalign family */
+#define MT_CALLOC  2  /* ptr = calloc(1, size) */
+#define MT_REALLOC 3  /* ptr = realloc(old, size): old is given up */
+#define MT_FREE    4  /* free(ptr) */
+#define MT_REALLOC_END 5 /* the realloc that gave up old returned ptr */
+
+/* Start of every chunk */
+typedef struct {
+    uint32_t magic;   /* MTRACE_MAGIC */
+    uint32_t count;   /* number of records that follow */
+} mtrace_chunk_t;
+
+/* One intercepted request */
+typedef struct {
+    uint64_t seq;     /* type in the top 8 bits, sequence number below */
+    uint64_t ptr;     /* block returned (or freed) */
+    uint64_t old;     /* realloc only: the block passed in */
+    uint64_t size;    /* requested bytes */
+} mtrace_rec_t;
+
+#define MT_SEQ_BITS 56
+#define MT_TYPE(r)  ((int)((r)->seq >> MT_SEQ_BITS))
+#define MT_SEQ(r)   ((r)->seq & ((1ULL << MT_SEQ_BITS) - 1))
+
+#endif /* __MTRACE_H_ */
@@ -0,0 +1,369 @@
+/*
+ * mtrace2rep.c - Convert a log written by libmtrace.so into a trace
+ *     file in the format that mdriver reads (see traces/README)
+ *
+ * Usage: mtrace2rep [-bB] <logfile> > <tracefile>
+ *
+ * Requests are put back in sequence order, and each block the program
+ * allocated becomes one trace id that follows the block through any
+ * reallocs until it is freed. Frees of blocks the log never saw (for
+ * example, blocks allocated before the interposer was loaded) are 
+ * dropped. With -b, the trace is balanced by freeing every block that
+ * is still allocated at the end, as traces/checktrace.pl does. With
+ * -B, the trace is written in the binary format of tstream.h, which
+ * mdriver reads much faster than text.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "mtrace.h"
+#include "tstream.h"
+
+/* A trace operation, as it will be printed */
+typedef struct {
+    char type;   /* 'a', 'r' or 'f' */
+    int id;      /* trace id */
+    int size;    /* bytes ('a' and 'r' only) */
+} op_t;
+
+/* Maps the address of a live block to its trace id */
+typedef struct {
+    uint64_t ptr;  /* block address, 0 if the slot is empty */
+    int id;        /* trace id */
+    int size;      /* current size, to compute the peak live bytes */
+} slot_t;
+
+static slot_t *table = NULL;  /* open addressing with linear probing */
+static size_t tablesize = 0;  /* always a power of 2 */
+static size_t nlive = 0;      /* number of occupied slots */
+
+/* Reallocs that gave up their old block but haven't returned yet */
+static slot_t *pending = NULL;  /* keyed by the block to be returned */
+static size_t npending = 0, maxpending = 0;
+
+static op_t *ops = NULL;
+static size_t nops = 0, maxops = 0;
+static int nids = 0;
+static long live_bytes = 0, peak_bytes = 0;
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/* hash - Spread block addresses, whose low bits are mostly zero */
+static size_t hash(uint64_t ptr)
+{
+    ptr ^= ptr >> 33;
+    ptr *= 0xff51afd7ed558ccdULL;
+    ptr ^= ptr >> 33;
+    return (size_t)ptr & (tablesize - 1);
+}
+
+/* find - Return the slot holding ptr, or the empty slot where it goes */
+static slot_t *find(uint64_t ptr)
+{
+    size_t i = hash(ptr);
+
+    while (table[i].ptr != 0 && table[i].ptr != ptr)
+	i = (i + 1) & (tablesize - 1);
+    return &table[i];
+}
+
+static void insert(uint64_t ptr, int id, int size);
+
+/* grow - Double the table once it is half full */
+static void grow(void)
+{
+    slot_t *old = table;
+    size_t i, oldsize = tablesize;
+
+    tablesize = oldsize ? 2 * oldsize : 1024;
+    if ((table = calloc(tablesize, sizeof(slot_t))) == NULL)
+	unix_error("calloc failed in grow");
+    nlive = 0;
+    for (i = 0; i < oldsize; i++)
+	if (old[i].ptr)
+	    insert(old[i].ptr, old[i].id, old[i].size);
+    free(old);
+}
+
+static void insert(uint64_t ptr, int id, int size)
+{
+    slot_t *s;
+
+    if (2 * (nlive + 1) > tablesize)
+	grow();
+    s = find(ptr);
+    s->ptr = ptr;
+    s->id = id;
+    s->size = size;
+    nlive++;
+}
+
+/* erase - Empty slot s, shifting later entries back over the hole */
+static void erase(slot_t *s)
+{
+    size_t i = s - table, j = i, home;
+
+    table[i].ptr = 0;
+    for (;;) {
+	j = (j + 1) & (tablesize - 1);
+	if (table[j].ptr == 0)
+	    break;
+	home = hash(table[j].ptr);
+	/* Move j into the hole unless its home lies in (i, j] */
+	if ((j > i && (home <= i || home > j)) ||
+	    (j < i && (home <= i && home > j))) {
+	    table[i] = table[j];
+	    table[j].ptr = 0;
+	    i = j;
+	}
+    }
+    nlive--;
+}
+
+/* emit - Append a trace operation */
+static void emit(char type, int id, int size)
+{
+    if (nops == maxops) {
+	maxops = maxops ? 2 * maxops : 1 << 16;
+	if ((ops = realloc(ops, maxops * sizeof(op_t))) == NULL)
+	    unix_error("realloc failed in emit");
+    }
+    ops[nops].type = type;
+    ops[nops].id = id;
+    ops[nops].size = size;
+    nops++;
+}
+
+/* trace_size - mdriver needs a positive int size */
+static int trace_size(uint64_t size)
+{
+    if (size == 0)
+	return 1;
+    return size > INT_MAX ? INT_MAX : (int)size;
+}
+
+/* do_free - Free the block in slot s */
+static void do_free(slot_t *s)
+{
+    emit('f', s->id, 0);
+    live_bytes -= s->size;
+    erase(s);
+}
+
+/* do_alloc - A new block ptr of size bytes */
+static void do_alloc(uint64_t ptr, uint64_t size)
+{
+    int sz = trace_size(size);
+
+    emit('a', nids, sz);
+    insert(ptr, nids++, sz);
+    live_bytes += sz;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/* 
+ * realloc_start - A realloc gave up block old, and will return ptr.
+ *     Another thread may get old before ptr is returned, so the 
+ *     block's id waits in pending until realloc_end.
+ */
+static void realloc_start(uint64_t ptr, uint64_t old)
+{
+    slot_t *s = find(old);
+
+    if (ptr == 0) {              /* realloc(old, 0) == free(old) */
+	if (s->ptr)
+	    do_free(s);
+	return;
+    }
+    if (npending == maxpending) {
+	maxpending = maxpending ? 2 * maxpending : 64;
+	if ((pending = realloc(pending, maxpending * sizeof(slot_t))) == NULL)
+	    unix_error("realloc failed in realloc_start");
+    }
+    pending[npending].ptr = ptr;
+    pending[npending].id = s->ptr ? s->id : -1;  /* -1: never saw old */
+    pending[npending].size = s->ptr ? s->size : 0;
+    npending++;
+    if (s->ptr)
+	erase(s);
+}
+
+/* realloc_end - The realloc of a pending block returned ptr, size bytes */
+static void realloc_end(uint64_t ptr, uint64_t size)
+{
+    size_t i;
+    int id, sz = trace_size(size);
+
+    for (i = 0; i < npending && pending[i].ptr != ptr; i++)
+	;
+    if (i == npending || pending[i].id < 0) {
+	if (i < npending)
+	    pending[i] = pending[--npending];
+	do_alloc(ptr, size);
+	return;
+    }
+    id = pending[i].id;
+    live_bytes += sz - pending[i].size;
+    pending[i] = pending[--npending];
+    emit('r', id, sz);
+    insert(ptr, id, sz);
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = MT_SEQ((mtrace_rec_t *)a), y = MT_SEQ((mtrace_rec_t *)b);
+
+    return (x > y) - (x < y);
+}
+
+/* read_log - Read every record in the log into one array */
+static mtrace_rec_t *read_log(char *path, size_t *nrecs)
+{
+    FILE *fp;
+    mtrace_chunk_t hdr;
+    mtrace_rec_t *recs = NULL;
+    size_t n = 0, max = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+	unix_error(path);
+    while (fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+	if (hdr.magic != MTRACE_MAGIC) {
+	    fprintf(stderr, "%s: bad chunk header, stopping\n", path);
+	    break;
+	}
+	if (n + hdr.count > max) {
+	    max = 2 * (n + hdr.count);
+	    if ((recs = realloc(recs, max * sizeof(mtrace_rec_t))) == NULL)
+		unix_error("realloc failed in read_log");
+	}
+	if (fread(recs + n, sizeof(mtrace_rec_t), hdr.count, fp) != hdr.count) {
+	    fprintf(stderr, "%s: truncated chunk, stopping\n", path);
+	    break;
+	}
+	n += hdr.count;
+    }
+    fclose(fp);
+    *nrecs = n;
+    return recs;
+}
+
+/* write_binary - Write the trace in the binary format of tstream.h */
+static void write_binary(void)
+{
+    tstream_hdr_t hdr;
+    tstream_op_t op;
+    size_t i;
+
+    if (nids > TS_MAX_ID) {
+	fprintf(stderr, "too many ids for the binary format\n");
+	exit(1);
+    }
+    hdr.magic = TSTREAM_MAGIC;
+    hdr.weight = 1;
+    hdr.num_ids = nids;
+    hdr.num_ops = nops;
+    fwrite(&hdr, sizeof(hdr), 1, stdout);
+    for (i = 0; i < nops; i++) {
+	op.op = TS_OP(ops[i].type == 'a' ? TS_ALLOC :
+		      ops[i].type == 'r' ? TS_REALLOC : TS_FREE, ops[i].id);
+	op.size = ops[i].type == 'f' ? 0 : ops[i].size;
+	fwrite(&op, sizeof(op), 1, stdout);
+    }
+    if (fflush(stdout) == EOF)
+	unix_error("write failed");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtrace2rep [-bB] <logfile> > <tracefile>\n");
+    fprintf(stderr, "\t-b  Free blocks still allocated at the end.\n");
+    fprintf(stderr, "\t-B  Write the trace in binary.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, balance = 0, binary = 0;
+    size_t i, nrecs, dropped = 0;
+    mtrace_rec_t *recs, *r;
+    slot_t *s;
+
+    while ((c = getopt(argc, argv, "bBh")) != -1) {
+	switch (c) {
+	case 'b':
+	    balance = 1;
+	    break;
+	case 'B':
+	    binary = 1;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+
+    recs = read_log(argv[optind], &nrecs);
+    qsort(recs, nrecs, sizeof(mtrace_rec_t), cmp_seq);
+    grow();
+
+    for (i = 0; i < nrecs; i++) {
+	r = &recs[i];
+	switch (MT_TYPE(r)) {
+	case MT_MALLOC:
+	case MT_CALLOC:
+	    do_alloc(r->ptr, r->size);
+	    break;
+	case MT_REALLOC:
+	    realloc_start(r->ptr, r->old);
+	    break;
+	case MT_REALLOC_END:
+	    realloc_end(r->ptr, r->size);
+	    break;
+	case MT_FREE:
+	    if ((s = find(r->ptr))->ptr)
+		do_free(s);
+	    else
+		dropped++;
+	    break;
+	default:
+	    fprintf(stderr, "bad record type %d\n", MT_TYPE(r));
+	    exit(1);
+	}
+    }
+    if (balance)
+	for (i = 0; i < tablesize; i++)
+	    if (table[i].ptr) {
+		emit('f', table[i].id, 0);
+		table[i].ptr = 0;
+	    }
+
+    /* Write the trace: the 4-line header and then one op per line */
+    if (binary)
+	write_binary();
+    else {
+	printf("%ld\n%d\n%lu\n1\n", peak_bytes, nids, (unsigned long)nops);
+	for (i = 0; i < nops; i++) {
+	    if (ops[i].type == 'f')
+		printf("f %d\n", ops[i].id);
+	    else
+		printf("%c %d %d\n", ops[i].type, ops[i].id, ops[i].size);
+	}
+    }
+
+    fprintf(stderr, "%lu records, %d ids, %lu ops, %lu unmatched frees, "
+	    "peak %ld live bytes\n", (unsigned long)nrecs, nids,
+	    (unsigned long)nops, (unsigned long)dropped, peak_bytes);
+    free(recs);
+    exit(0);
+}
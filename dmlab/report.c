@@ -0,0 +1,356 @@
+/*
+ * report.c - Write, read and compare mdriver reports (see report.h)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+
+#include "report.h"
+
+/* The numeric columns, in the order they are written */
+static struct {
+    char *name;
+    size_t off;
+} fields[] = {
+    {"util",       offsetof(report_row_t, util)},
+    {"avg_util",   offsetof(report_row_t, avg_util)},
+    {"ops",        offsetof(report_row_t, ops)},
+    {"secs",       offsetof(report_row_t, secs)},
+    {"kops",       offsetof(report_row_t, kops)},
+    {"ns_per_op",  offsetof(report_row_t, ns_per_op)},
+    {"mad",        offsetof(report_row_t, mad)},
+    {"ci_lo",      offsetof(report_row_t, ci_lo)},
+    {"ci_hi",      offsetof(report_row_t, ci_hi)},
+    {"warm_secs",  offsetof(report_row_t, warm_secs)},
+    {"touched_kb", offsetof(report_row_t, touched_kb)},
+    {"minflt",     offsetof(report_row_t, minflt)},
+    {"perfindex",  offsetof(report_row_t, perfindex)},
+};
+#define NFIELDS (sizeof(fields) / sizeof(fields[0]))
+#define FIELD(row, i) ((double *)((char *)(row) + fields[i].off))
+
+static void report_error(char *path, char *msg)
+{
+    fprintf(stderr, "ERROR: %s: %s\n", path, msg);
+    exit(1);
+}
+
+static int is_csv(char *path)
+{
+    size_t len = strlen(path);
+
+    return len >= 4 && !strcmp(path + len - 4, ".csv");
+}
+
+/*
+ * set_field - Set the column called name in row, ignoring names we
+ *     don't know so that newer reports can be read by older drivers
+ */
+static void set_field(report_row_t *row, char *name, char *value)
+{
+    size_t i;
+
+    if (!strcmp(name, "package"))
+	snprintf(row->package, REPORT_NAMELEN, "%s", value);
+    else if (!strcmp(name, "trace"))
+	snprintf(row->trace, REPORT_NAMELEN, "%s", value);
+    else if (!strcmp(name, "valid"))
+	row->valid = atoi(value);
+    else
+	for (i = 0; i < NFIELDS; i++)
+	    if (!strcmp(name, fields[i].name))
+		*FIELD(row, i) = atof(value);
+}
+
+/* put_string - Write s as a JSON string */
+static void put_string(FILE *fp, char *s)
+{
+    putc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    putc('\\', fp);
+	putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/* put_csv - Write s as a CSV field, quoted if it needs to be (RFC 4180) */
+static void put_csv(FILE *fp, char *s)
+{
+    if (!strpbrk(s, ",\"\r\n")) {
+	fputs(s, fp);
+	return;
+    }
+    putc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"')
+	    putc('"', fp);
+	putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * report_write - Write n rows to path
+ */
+void report_write(char *path, report_row_t *rows, int n)
+{
+    FILE *fp;
+    int i;
+    size_t j;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	report_error(path, "can't create the report");
+
+    if (is_csv(path)) {
+	fprintf(fp, "package,trace,valid");
+	for (j = 0; j < NFIELDS; j++)
+	    fprintf(fp, ",%s", fields[j].name);
+	fprintf(fp, "\n");
+	for (i = 0; i < n; i++) {
+	    put_csv(fp, rows[i].package);
+	    putc(',', fp);
+	    put_csv(fp, rows[i].trace);
+	    fprintf(fp, ",%d", rows[i].valid);
+	    for (j = 0; j < NFIELDS; j++)
+		fprintf(fp, ",%.9g", *FIELD(&rows[i], j));
+	    fprintf(fp, "\n");
+	}
+    }
+    else {
+	fprintf(fp, "{\n  \"rows\": [\n");
+	for (i = 0; i < n; i++) {
+	    fprintf(fp, "    {\"package\": ");
+	    put_string(fp, rows[i].package);
+	    fprintf(fp, ", \"trace\": ");
+	    put_string(fp, rows[i].trace);
+	    fprintf(fp, ", \"valid\": %d", rows[i].valid);
+	    for (j = 0; j < NFIELDS; j++)
+		fprintf(fp, ", \"%s\": %.9g", fields[j].name,
+			*FIELD(&rows[i], j));
+	    fprintf(fp, "}%s\n", i < n - 1 ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+    }
+    if (fclose(fp) == EOF)
+	report_error(path, "write failed");
+}
+
+/* add_row - Append row to the growing array *rows of *n rows */
+static void add_row(report_row_t **rows, int *n, report_row_t *row)
+{
+    if ((*n & (*n - 1)) == 0 &&
+	(*rows = realloc(*rows, (*n ? 2 * *n : 1) * sizeof(report_row_t)))
+	== NULL) {
+	fprintf(stderr, "ERROR: realloc failed in add_row\n");
+	exit(1);
+    }
+    (*rows)[(*n)++] = *row;
+}
+
+/*
+ * get_csv - Split the next field off the line at *p, undoing the 
+ *     quoting of put_csv in place. Returns NULL at the end of the line.
+ */
+static char *get_csv(char **p)
+{
+    char *cell = *p, *in = *p, *out = *p;
+
+    if (*in == '\0' || *in == '\n' || *in == '\r')
+	return NULL;
+    if (*in == '"') {
+	for (in++; *in; in++) {
+	    if (*in == '"' && *++in != '"')
+		break;
+	    *out++ = *in;
+	}
+    }
+    while (*in && *in != ',' && *in != '\n' && *in != '\r')
+	*out++ = *in++;
+    *p = *in == ',' ? in + 1 : in;
+    *out = '\0';
+    return cell;
+}
+
+/*
+ * read_csv - Read a CSV report, whose first line names the columns.
+ *     Quoted fields may hold commas and quotes, but not line breaks.
+ */
+static report_row_t *read_csv(char *path, FILE *fp, int *n)
+{
+    char line[4096], *names[64], *cell, *p;
+    int i, ncols = 0;
+    report_row_t row, *rows = NULL;
+
+    *n = 0;
+    if (!fgets(line, sizeof(line), fp))
+	report_error(path, "empty report");
+    for (p = line; (cell = get_csv(&p)) && ncols < 64; )
+	names[ncols++] = strdup(cell);
+
+    while (fgets(line, sizeof(line), fp)) {
+	memset(&row, 0, sizeof(row));
+	i = 0;
+	for (p = line; (cell = get_csv(&p)) && i < ncols; )
+	    set_field(&row, names[i++], cell);
+	if (row.package[0])
+	    add_row(&rows, n, &row);
+    }
+    for (i = 0; i < ncols; i++)
+	free(names[i]);
+    return rows;
+}
+
+/* get_string - Read the JSON string that starts at *p into buf */
+static char *get_string(char *p, char *buf, size_t size)
+{
+    size_t i = 0;
+
+    for (p++; *p && *p != '"'; p++) {
+	if (*p == '\\' && p[1])
+	    p++;
+	if (i < size - 1)
+	    buf[i++] = *p;
+    }
+    buf[i] = '\0';
+    return *p ? p + 1 : p;
+}
+
+/*
+ * read_json - Read a JSON report. This only understands the flat
+ *     objects that report_write produces, not JSON in general.
+ */
+static report_row_t *read_json(char *path, FILE *fp, int *n)
+{
+    char *text, *p, key[64], value[REPORT_NAMELEN];
+    long len;
+    report_row_t row, *rows = NULL;
+
+    *n = 0;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((text = malloc(len + 1)) == NULL)
+	report_error(path, "out of memory");
+    if (fread(text, 1, len, fp) != (size_t)len)
+	report_error(path, "read failed");
+    text[len] = '\0';
+
+    memset(&row, 0, sizeof(row));
+    for (p = text; *p; ) {
+	if (*p == '{' || *p == '}') {
+	    if (*p == '}' && row.package[0])
+		add_row(&rows, n, &row);
+	    memset(&row, 0, sizeof(row));
+	    p++;
+	}
+	else if (*p == '"') {
+	    p = get_string(p, key, sizeof(key));
+	    while (isspace((unsigned char)*p))
+		p++;
+	    if (*p != ':')
+		continue;
+	    for (p++; isspace((unsigned char)*p); p++)
+		;
+	    if (*p == '"')
+		p = get_string(p, value, sizeof(value));
+	    else if (*p == '[')
+		continue;
+	    else {
+		for (len = 0; *p && !strchr(",}] \t\n", *p) &&
+			 len < REPORT_NAMELEN - 1; p++)
+		    value[len++] = *p;
+		value[len] = '\0';
+	    }
+	    set_field(&row, key, value);
+	}
+	else
+	    p++;
+    }
+    free(text);
+    return rows;
+}
+
+/*
+ * report_read - Read a report written by report_write
+ */
+report_row_t *report_read(char *path, int *n)
+{
+    FILE *fp;
+    report_row_t *rows;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	report_error(path, "can't open the baseline");
+    rows = is_csv(path) ? read_csv(path, fp, n) : read_json(path, fp, n);
+    fclose(fp);
+    if (*n == 0)
+	report_error(path, "no results in the baseline");
+    return rows;
+}
+
+/*
+ * regressed - Print and count one metric if it got worse by more
+ *     than threshold. Metrics that either run didn't measure are 0
+ *     and are skipped.
+ */
+static int regressed(report_row_t *row, char *metric, double base,
+		     double now, int higher_is_better, double threshold)
+{
+    double change;
+
+    if (base <= 0 || now <= 0)
+	return 0;
+    change = (now - base) / base;
+    if (higher_is_better ? change >= -threshold : change <= threshold)
+	return 0;
+    printf("%-16s%-24s%-12s%14.6g%14.6g%+8.1f%%\n", row->package,
+	   row->trace, metric, base, now, 100.0 * change);
+    return 1;
+}
+
+/*
+ * report_compare - Compare rows against the baseline rows for the
+ *     same package and trace
+ */
+int report_compare(report_row_t *base, int nbase,
+		   report_row_t *rows, int n, double threshold)
+{
+    int i, j, count = 0, matched = 0;
+    report_row_t *b;
+
+    printf("\nRegressions against the baseline (threshold %.1f%%):\n",
+	   100.0 * threshold);
+    printf("%-16s%-24s%-12s%14s%14s%9s\n",
+	   "package", "trace", "metric", "baseline", "now", "change");
+    for (i = 0; i < n; i++) {
+	for (j = 0, b = NULL; j < nbase && b == NULL; j++)
+	    if (!strcmp(base[j].package, rows[i].package) &&
+		!strcmp(base[j].trace, rows[i].trace))
+		b = &base[j];
+	if (b == NULL)
+	    continue;
+	matched++;
+
+	if (b->valid && !rows[i].valid) {
+	    printf("%-16s%-24s%-12s%14s%14s\n", rows[i].package,
+		   rows[i].trace, "valid", "yes", "no");
+	    count++;
+	    continue;
+	}
+	count += regressed(&rows[i], "util", b->util, rows[i].util,
+			   1, threshold);
+	count += regressed(&rows[i], "kops", b->kops, rows[i].kops,
+			   1, threshold);
+	count += regressed(&rows[i], "warm_secs", b->warm_secs,
+			   rows[i].warm_secs, 0, threshold);
+	count += regressed(&rows[i], "touched_kb", b->touched_kb,
+			   rows[i].touched_kb, 0, threshold);
+	count += regressed(&rows[i], "perfindex", b->perfindex,
+			   rows[i].perfindex, 1, threshold);
+    }
+    printf("%d regressions in %d results matched with the baseline\n",
+	   count, matched);
+    return count;
+}
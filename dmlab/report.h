@@ -0,0 +1,47 @@
+/*
+ * report.h - Machine-readable mdriver results (-o) and comparison
+ *     against the results of an earlier run (-B)
+ *
+ * A report is a list of rows, one per package and trace, plus one
+ * row per package whose trace is "total". It is written as JSON or
+ * CSV depending on the file name, and either can be read back as a
+ * baseline.
+ */
+#ifndef __REPORT_H_
+#define __REPORT_H_
+
+#define REPORT_NAMELEN 128
+
+typedef struct {
+    char package[REPORT_NAMELEN]; /* allocator_t name */
+    char trace[REPORT_NAMELEN];   /* trace file, or "total" */
+    int valid;
+    double util;        /* peak utilization */
+    double avg_util;    /* time-averaged utilization (-u) */
+    double ops;
+    double secs;
+    double kops;        /* thousands of requests per second */
+    double ns_per_op;   /* mean latency of a request */
+    double mad;         /* spread of the samples (-s) */
+    double ci_lo, ci_hi;/* confidence interval of secs (-s) */
+    double warm_secs;   /* secs with a warm cache (-w) */
+    double touched_kb;  /* heap pages touched (-r) */
+    double minflt;      /* minor page faults (-r) */
+    double perfindex;   /* performance index ("total" rows only) */
+} report_row_t;
+
+/* Write n rows to path, as CSV if it ends in .csv and JSON otherwise */
+void report_write(char *path, report_row_t *rows, int n);
+
+/* Read the rows of a report written by report_write; exits on error */
+report_row_t *report_read(char *path, int *n);
+
+/*
+ * Print every metric of rows that got worse than in the matching
+ * baseline row by more than threshold (a fraction), and return the
+ * number of such regressions
+ */
+int report_compare(report_row_t *base, int nbase,
+		   report_row_t *rows, int n, double threshold);
+
+#endif /* __REPORT_H_ */
@@ -0,0 +1,443 @@
+/*
+ * gentrace.c - Generate a synthetic trace with configurable size and
+ *     lifetime distributions, realloc ratio and phases
+ *
+ * Usage: gentrace [-b] [-u] [-S seed] <phase options> [-P <phase options>]... <outfile>
+ *
+ * Phase options (each -P starts a new phase that inherits the
+ * settings of the one before it):
+ *     -n <ops>     Requests in this phase (default 10000)
+ *     -s <dist>    Distribution of block sizes in bytes
+ *     -l <dist>    Distribution of block lifetimes in requests
+ *     -r <ratio>   Fraction of requests that realloc a random live
+ *                  block to a new size drawn from the size distribution,
+ *                  so a block may shrink as well as grow
+ *
+ * A <dist> is one of
+ *     uniform:<min>:<max>
+ *     lognormal:<mu>:<sigma>        exp(mu + sigma*N(0,1))
+ *     powerlaw:<min>:<max>:<alpha>  density proportional to x^-alpha
+ *     bimodal:<a>:<b>:<p>           a with probability p, else b
+ *
+ * Each block is freed once its lifetime has passed, and every block
+ * still live at the end is freed then, so the trace is balanced
+ * (unless -u). The time to the next free is kept in a min-heap, so
+ * generation takes O(log live) per request. With -b, the trace is
+ * written in the binary format of ../tstream.h instead of text.
+ * The same seed always produces the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../tstream.h"
+
+#define MAXPHASES 64
+#define MAXSIZE   (1 << 30)        /* largest request mdriver accepts */
+#define OUTBUF    (1 << 20)
+
+/* A distribution of positive integers */
+typedef struct {
+    enum {UNIFORM, LOGNORMAL, POWERLAW, BIMODAL} kind;
+    double a, b, c;
+} dist_t;
+
+/* One phase of the trace */
+typedef struct {
+    long ops;          /* requests in this phase */
+    dist_t size;       /* block sizes */
+    dist_t life;       /* block lifetimes, in requests */
+    double realloc;    /* fraction of requests that are reallocs */
+} phase_t;
+
+/* A live block in the min-heap, ordered by time of death */
+typedef struct {
+    uint64_t death;
+    uint32_t id;
+    uint32_t size;
+} block_t;
+
+static block_t *heap = NULL;
+static size_t nheap = 0, maxheap = 0;
+
+static FILE *out;
+static int binary = 0;
+static char outbuf[OUTBUF];
+static size_t outlen = 0;
+
+static uint64_t num_ids = 0, num_ops = 0;
+static uint64_t live_bytes = 0, peak_bytes = 0;
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-bu] [-S seed] [-n ops] [-s dist] "
+	    "[-l dist] [-r ratio] [-P ...] <outfile>\n");
+    fprintf(stderr, "\t-b  Write the binary format instead of text.\n");
+    fprintf(stderr, "\t-u  Don't free the blocks live at the end.\n");
+    fprintf(stderr, "\t-P  Start a new phase.\n");
+    fprintf(stderr, "\tdist: uniform:min:max | lognormal:mu:sigma |\n"
+	    "\t      powerlaw:min:max:alpha | bimodal:a:b:p\n");
+    exit(1);
+}
+
+/*******************
+ * Random numbers
+ *******************/
+
+static uint64_t rng[4];
+
+/* seed - Expand the seed with splitmix64, as xoshiro recommends */
+static void seed(uint64_t x)
+{
+    int i;
+    uint64_t z;
+
+    for (i = 0; i < 4; i++) {
+	z = (x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	rng[i] = z ^ (z >> 31);
+    }
+}
+
+/* next - xoshiro256** */
+static uint64_t next(void)
+{
+    uint64_t r = rng[1] * 5, t = rng[1] << 17;
+
+    r = ((r << 7) | (r >> 57)) * 9;
+    rng[2] ^= rng[0];
+    rng[3] ^= rng[1];
+    rng[1] ^= rng[2];
+    rng[0] ^= rng[3];
+    rng[2] ^= t;
+    rng[3] = (rng[3] << 45) | (rng[3] >> 19);
+    return r;
+}
+
+/* below - Uniform on [0, n), by multiplying rather than dividing */
+static uint64_t below(uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)next() * n) >> 64);
+}
+
+/* unif - Uniform on (0, 1) */
+static double unif(void)
+{
+    return ((next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* normal - Standard normal by the Box-Muller transform */
+static double normal(void)
+{
+    static int have = 0;
+    static double saved;
+    double r, t;
+
+    if (have) {
+	have = 0;
+	return saved;
+    }
+    r = sqrt(-2 * log(unif()));
+    t = 2 * M_PI * unif();
+    saved = r * sin(t);
+    have = 1;
+    return r * cos(t);
+}
+
+/* draw - A value from distribution d, clamped to [1, MAXSIZE] */
+static uint32_t draw(dist_t *d)
+{
+    double x, e;
+
+    switch (d->kind) {
+    case UNIFORM:
+	x = d->a + (double)below((uint64_t)(d->b - d->a + 1));
+	break;
+    case LOGNORMAL:
+	x = exp(d->a + d->b * normal());
+	break;
+    case POWERLAW:
+	/* Invert the CDF of x^-alpha on [min, max] */
+	if (fabs(d->c - 1) < 1e-9)
+	    x = d->a * pow(d->b / d->a, unif());
+	else {
+	    e = 1 - d->c;
+	    x = pow(pow(d->a, e) + unif() * (pow(d->b, e) - pow(d->a, e)),
+		    1 / e);
+	}
+	break;
+    default: /* BIMODAL */
+	x = unif() < d->c ? d->a : d->b;
+	break;
+    }
+    if (x < 1)
+	return 1;
+    return x > MAXSIZE ? MAXSIZE : (uint32_t)x;
+}
+
+/* parse_dist - Parse a <dist> argument */
+static void parse_dist(char *s, dist_t *d)
+{
+    int n = 0;
+
+    d->c = 0;
+    if (!strncmp(s, "uniform:", 8)) {
+	d->kind = UNIFORM;
+	n = sscanf(s + 8, "%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b;
+    }
+    else if (!strncmp(s, "lognormal:", 10)) {
+	d->kind = LOGNORMAL;
+	n = sscanf(s + 10, "%lf:%lf", &d->a, &d->b) == 2;
+    }
+    else if (!strncmp(s, "powerlaw:", 9)) {
+	d->kind = POWERLAW;
+	n = sscanf(s + 9, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+	    d->a >= 1 && d->a < d->b;
+    }
+    else if (!strncmp(s, "bimodal:", 8)) {
+	d->kind = BIMODAL;
+	n = sscanf(s + 8, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3;
+    }
+    if (!n) {
+	fprintf(stderr, "gentrace: bad distribution \"%s\"\n", s);
+	usage();
+    }
+}
+
+/*******************
+ * The min-heap
+ *******************/
+
+static void push(uint64_t death, uint32_t id, uint32_t size)
+{
+    size_t i, parent;
+
+    if (nheap == maxheap) {
+	maxheap = maxheap ? 2 * maxheap : 1024;
+	if ((heap = realloc(heap, maxheap * sizeof(block_t))) == NULL)
+	    unix_error("realloc failed in push");
+    }
+    for (i = nheap++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (heap[parent].death <= death)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i].death = death;
+    heap[i].id = id;
+    heap[i].size = size;
+}
+
+/* pop - Remove the block that dies first */
+static block_t pop(void)
+{
+    block_t top = heap[0], last = heap[--nheap];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < nheap) {
+	if (child + 1 < nheap && heap[child + 1].death < heap[child].death)
+	    child++;
+	if (last.death <= heap[child].death)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*******************
+ * Output
+ *******************/
+
+static void flush_out(void)
+{
+    if (outlen && fwrite(outbuf, 1, outlen, out) != outlen)
+	unix_error("write failed");
+    outlen = 0;
+}
+
+/* put_uint - Append the decimal digits of x */
+static void put_uint(uint64_t x)
+{
+    char digits[24];
+    int n = 0;
+
+    do {
+	digits[n++] = '0' + x % 10;
+	x /= 10;
+    } while (x);
+    while (n)
+	outbuf[outlen++] = digits[--n];
+}
+
+/* emit - Append one request */
+static void emit(int type, uint32_t id, uint32_t size)
+{
+    tstream_op_t op;
+
+    if (outlen > OUTBUF - 64)
+	flush_out();
+    num_ops++;
+    if (binary) {
+	op.op = TS_OP(type, id);
+	op.size = size;
+	memcpy(outbuf + outlen, &op, sizeof(op));
+	outlen += sizeof(op);
+	return;
+    }
+    outbuf[outlen++] = type == TS_ALLOC ? 'a' : type == TS_FREE ? 'f' : 'r';
+    outbuf[outlen++] = ' ';
+    put_uint(id);
+    if (type != TS_FREE) {
+	outbuf[outlen++] = ' ';
+	put_uint(size);
+    }
+    outbuf[outlen++] = '\n';
+}
+
+/*
+ * write_header - Write the header, which is rewritten with the final
+ *     counts once the trace is done. The text header is padded to a
+ *     fixed width so that it can be rewritten in place.
+ */
+static void write_header(void)
+{
+    tstream_hdr_t hdr;
+
+    if (binary) {
+	hdr.magic = TSTREAM_MAGIC;
+	hdr.weight = 1;
+	hdr.num_ids = num_ids;
+	hdr.num_ops = num_ops;
+	fwrite(&hdr, sizeof(hdr), 1, out);
+    }
+    else
+	fprintf(out, "%20lu\n%20lu\n%20lu\n1\n", (unsigned long)peak_bytes,
+		(unsigned long)num_ids, (unsigned long)num_ops);
+}
+
+/*******************
+ * Generation
+ *******************/
+
+static void do_free(block_t b)
+{
+    emit(TS_FREE, b.id, 0);
+    live_bytes -= b.size;
+}
+
+/* run_phase - Generate the requests of one phase, starting at time *t */
+static void run_phase(phase_t *p, uint64_t *t)
+{
+    uint64_t end = *t + p->ops;
+    block_t *b;
+    uint32_t size;
+
+    for (; *t < end; (*t)++) {
+	if (nheap && heap[0].death <= *t)
+	    do_free(pop());
+	else if (p->realloc > 0 && nheap && unif() < p->realloc) {
+	    b = &heap[below(nheap)];
+	    size = draw(&p->size);
+	    live_bytes = live_bytes - b->size + size;
+	    b->size = size;
+	    emit(TS_REALLOC, b->id, size);
+	}
+	else {
+	    if (num_ids > TS_MAX_ID) {
+		fprintf(stderr, "gentrace: too many ids\n");
+		exit(1);
+	    }
+	    size = draw(&p->size);
+	    live_bytes += size;
+	    emit(TS_ALLOC, num_ids, size);
+	    push(*t + draw(&p->life), num_ids++, size);
+	}
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nphases = 1, balance = 1;
+    phase_t phases[MAXPHASES];
+    uint64_t t = 0;
+
+    phases[0].ops = 10000;
+    parse_dist("uniform:1:4096", &phases[0].size);
+    parse_dist("uniform:1:1000", &phases[0].life);
+    phases[0].realloc = 0;
+    seed(1);
+
+    while ((c = getopt(argc, argv, "bun:s:l:r:PS:h")) != -1) {
+	phase_t *p = &phases[nphases - 1];
+
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 'u':
+	    balance = 0;
+	    break;
+	case 'n':
+	    p->ops = (long)atof(optarg);
+	    break;
+	case 's':
+	    parse_dist(optarg, &p->size);
+	    break;
+	case 'l':
+	    parse_dist(optarg, &p->life);
+	    break;
+	case 'r':
+	    p->realloc = atof(optarg);
+	    break;
+	case 'P':
+	    if (nphases == MAXPHASES)
+		usage();
+	    phases[nphases] = *p;
+	    nphases++;
+	    break;
+	case 'S':
+	    seed(strtoull(optarg, NULL, 0));
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+
+    if ((out = fopen(argv[optind], "wb")) == NULL)
+	unix_error(argv[optind]);
+    write_header();
+
+    for (i = 0; i < nphases; i++)
+	run_phase(&phases[i], &t);
+    if (balance)
+	while (nheap)
+	    do_free(pop());
+    flush_out();
+
+    /* Now that the counts are known, rewrite the header */
+    rewind(out);
+    write_header();
+    if (fclose(out) == EOF)
+	unix_error(argv[optind]);
+
+    fprintf(stderr, "%lu ids, %lu ops, peak %lu live bytes\n",
+	    (unsigned long)num_ids, (unsigned long)num_ops,
+	    (unsigned long)peak_bytes);
+    exit(0);
+}
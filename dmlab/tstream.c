@@ -0,0 +1,331 @@
+/*
+ * tstream.c - Read a trace in chunks on a helper thread, double
+ *     buffered so that the next chunk is usually ready by the time
+ *     mdriver has replayed the current one
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tstream.h"
+
+struct tstream {
+    FILE *fp;
+    char *path;
+    int binary;                 /* binary format, else text */
+    tstream_hdr_t hdr;
+
+    /* Buffer b is full (owned by the consumer) iff full[b] is set */
+    tstream_op_t *buf[2];
+    int count[2];               /* requests in each full buffer */
+    int full[2];
+    int next;                   /* buffer the consumer reads next */
+    int held;                   /* buffer the consumer holds, or -1 */
+    int done;                   /* tells the helper to stop */
+    unsigned long stalls;
+
+    pthread_t helper;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void stream_error(tstream_t *ts, char *msg)
+{
+    fprintf(stderr, "%s: %s\n", ts->path, msg);
+    exit(1);
+}
+
+/*
+ * read_text - Parse up to TSTREAM_CHUNK lines of a text trace
+ */
+static int read_text(tstream_t *ts, tstream_op_t *ops)
+{
+    char type[8];
+    unsigned id, size;
+    int n;
+
+    for (n = 0; n < TSTREAM_CHUNK; n++) {
+	if (fscanf(ts->fp, "%7s", type) != 1)
+	    break;
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(ts->fp, "%u %u", &id, &size) != 2)
+		stream_error(ts, "read failure");
+	    break;
+	case 'f':
+	    if (fscanf(ts->fp, "%u", &id) != 1)
+		stream_error(ts, "read failure");
+	    break;
+	default:
+	    stream_error(ts, "bogus type character");
+	}
+	if (id > TS_MAX_ID)
+	    stream_error(ts, "id too large");
+	ops[n].op = TS_OP(type[0] == 'a' ? TS_ALLOC :
+			  type[0] == 'r' ? TS_REALLOC : TS_FREE, id);
+	ops[n].size = size;
+    }
+    return n;
+}
+
+/*
+ * prefetch - The helper thread: fill whichever buffer the consumer
+ *     isn't using, until the end of the trace
+ */
+static void *prefetch(void *arg)
+{
+    tstream_t *ts = (tstream_t *)arg;
+    int b = 0, n, done;
+
+    for (;;) {
+	pthread_mutex_lock(&ts->lock);
+	while (ts->full[b] && !ts->done)
+	    pthread_cond_wait(&ts->cond, &ts->lock);
+	done = ts->done;
+	pthread_mutex_unlock(&ts->lock);
+	if (done)
+	    break;
+
+	if (ts->binary)
+	    n = fread(ts->buf[b], sizeof(tstream_op_t), TSTREAM_CHUNK, ts->fp);
+	else
+	    n = read_text(ts, ts->buf[b]);
+
+	/* An empty buffer marks the end of the trace */
+	pthread_mutex_lock(&ts->lock);
+	ts->count[b] = n;
+	ts->full[b] = 1;
+	pthread_cond_broadcast(&ts->cond);
+	pthread_mutex_unlock(&ts->lock);
+	if (n == 0)
+	    break;
+	b ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * tstream_open - Open the trace at path, read its header and start
+ *     the helper thread on the first chunk
+ */
+tstream_t *tstream_open(char *path)
+{
+    tstream_t *ts;
+    int sugg_heapsize, num_ids, num_ops, weight;
+
+    if ((ts = calloc(1, sizeof(tstream_t))) == NULL ||
+	(ts->buf[0] = malloc(TSTREAM_CHUNK * sizeof(tstream_op_t))) == NULL ||
+	(ts->buf[1] = malloc(TSTREAM_CHUNK * sizeof(tstream_op_t))) == NULL) {
+	fprintf(stderr, "tstream_open: malloc error\n");
+	exit(1);
+    }
+    ts->path = strdup(path);
+    if ((ts->fp = fopen(path, "rb")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+
+    if (fread(&ts->hdr, sizeof(ts->hdr), 1, ts->fp) == 1 &&
+	ts->hdr.magic == TSTREAM_MAGIC) {
+	ts->binary = 1;
+    }
+    else {
+	/* A text trace: the header is four numbers */
+	rewind(ts->fp);
+	if (fscanf(ts->fp, "%d %d %d %d", &sugg_heapsize, &num_ids,
+		   &num_ops, &weight) != 4)
+	    stream_error(ts, "failure reading header");
+	ts->hdr.magic = TSTREAM_MAGIC;
+	ts->hdr.weight = weight;
+	ts->hdr.num_ids = num_ids;
+	ts->hdr.num_ops = num_ops;
+    }
+
+    ts->held = -1;
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->cond, NULL);
+    if (pthread_create(&ts->helper, NULL, prefetch, ts) != 0)
+	stream_error(ts, "pthread_create failed");
+    return ts;
+}
+
+tstream_hdr_t *tstream_header(tstream_t *ts)
+{
+    return &ts->hdr;
+}
+
+/*
+ * tstream_next - Hand the buffer we were holding back to the helper
+ *     and take the next one, waiting if it hasn't been read yet
+ */
+int tstream_next(tstream_t *ts, tstream_op_t **ops)
+{
+    int b, n;
+
+    pthread_mutex_lock(&ts->lock);
+    if (ts->held >= 0) {
+	ts->full[ts->held] = 0;
+	ts->held = -1;
+	pthread_cond_broadcast(&ts->cond);
+    }
+    b = ts->next;
+    if (!ts->full[b]) {
+	ts->stalls++;
+	while (!ts->full[b])
+	    pthread_cond_wait(&ts->cond, &ts->lock);
+    }
+    /* Leave the end marker in place so later calls also return 0 */
+    if ((n = ts->count[b]) > 0) {
+	ts->held = b;
+	ts->next = b ^ 1;
+	*ops = ts->buf[b];
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return n;
+}
+
+unsigned long tstream_stalls(tstream_t *ts)
+{
+    return ts->stalls;
+}
+
+void tstream_close(tstream_t *ts)
+{
+    pthread_mutex_lock(&ts->lock);
+    ts->done = 1;
+    pthread_cond_broadcast(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+    pthread_join(ts->helper, NULL);
+
+    fclose(ts->fp);
+    pthread_mutex_destroy(&ts->lock);
+    pthread_cond_destroy(&ts->cond);
+    free(ts->buf[0]);
+    free(ts->buf[1]);
+    free(ts->path);
+    free(ts);
+}
+
+
+/*************************************************************
+ * The live-id map
+ ************************************************************/
+
+#define LIVE_MINSLOTS 1024
+
+/* live_hash - Fibonacci hashing; ids are dense, so this spreads them */
+static size_t live_hash(livemap_t *map, uint32_t id)
+{
+    return (size_t)(id * 0x9e3779b97f4a7c15ULL >> 20) & map->mask;
+}
+
+static void live_alloc(livemap_t *map, size_t nslots)
+{
+    size_t i;
+
+    if ((map->slots = malloc(nslots * sizeof(live_t))) == NULL) {
+	fprintf(stderr, "live_alloc: malloc error\n");
+	exit(1);
+    }
+    for (i = 0; i < nslots; i++)
+	map->slots[i].id = LIVE_EMPTY;
+    map->mask = nslots - 1;
+    map->n = 0;
+}
+
+void live_init(livemap_t *map)
+{
+    live_alloc(map, LIVE_MINSLOTS);
+}
+
+/* live_clear - Forget every block, keeping the current table size */
+void live_clear(livemap_t *map)
+{
+    size_t i;
+
+    for (i = 0; i <= map->mask; i++)
+	map->slots[i].id = LIVE_EMPTY;
+    map->n = 0;
+}
+
+void live_free(livemap_t *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+}
+
+live_t *live_find(livemap_t *map, uint32_t id)
+{
+    size_t i = live_hash(map, id);
+
+    while (map->slots[i].id != id) {
+	if (map->slots[i].id == LIVE_EMPTY)
+	    return NULL;
+	i = (i + 1) & map->mask;
+    }
+    return &map->slots[i];
+}
+
+/* live_grow - Double the table once it is half full */
+static void live_grow(livemap_t *map)
+{
+    live_t *old = map->slots, *e;
+    size_t i, oldslots = map->mask + 1;
+
+    live_alloc(map, 2 * oldslots);
+    for (i = 0; i < oldslots; i++)
+	if (old[i].id != LIVE_EMPTY) {
+	    e = live_insert(map, old[i].id);
+	    e->size = old[i].size;
+	    e->p = old[i].p;
+	}
+    free(old);
+}
+
+/* live_reserve - Grow the table now, so that it can hold n blocks 
+   without growing in live_insert */
+void live_reserve(livemap_t *map, size_t n)
+{
+    while (2 * n > map->mask + 1)
+	live_grow(map);
+}
+
+live_t *live_insert(livemap_t *map, uint32_t id)
+{
+    size_t i;
+
+    if (2 * (map->n + 1) > map->mask + 1)
+	live_grow(map);
+    for (i = live_hash(map, id); map->slots[i].id != LIVE_EMPTY;
+	 i = (i + 1) & map->mask)
+	if (map->slots[i].id == id)
+	    return NULL;
+    map->slots[i].id = id;
+    map->n++;
+    return &map->slots[i];
+}
+
+/* live_remove - Empty slot e, shifting later entries back over the hole */
+void live_remove(livemap_t *map, live_t *e)
+{
+    size_t i = e - map->slots, j = i, home;
+
+    map->slots[i].id = LIVE_EMPTY;
+    for (;;) {
+	j = (j + 1) & map->mask;
+	if (map->slots[j].id == LIVE_EMPTY)
+	    break;
+	home = live_hash(map, map->slots[j].id);
+	/* Move j into the hole unless its home lies in (i, j] */
+	if ((j > i && (home <= i || home > j)) ||
+	    (j < i && (home <= i && home > j))) {
+	    map->slots[i] = map->slots[j];
+	    map->slots[j].id = LIVE_EMPTY;
+	    i = j;
+	}
+    }
+    map->n--;
+}
@@ -0,0 +1,94 @@
+/*
+ * tstream.h - Stream the requests of a trace from disk in chunks, so
+ *     that traces larger than memory can be replayed (mdriver -S)
+ *
+ * A helper thread reads the next chunk while mdriver replays the
+ * current one. Both the text format of traces/README and the binary
+ * format below are accepted; the binary format is much faster to read
+ * and is what mtrace2rep writes with -B.
+ */
+#ifndef __TSTREAM_H_
+#define __TSTREAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Binary trace format (native byte order): a tstream_hdr_t followed
+ * by num_ops tstream_op_t records
+ */
+#define TSTREAM_MAGIC 0x31525442U /* "BTR1" */
+
+typedef struct {
+    uint32_t magic;     /* TSTREAM_MAGIC */
+    uint32_t weight;    /* weight for this trace (unused) */
+    uint64_t num_ids;   /* number of alloc/realloc ids */
+    uint64_t num_ops;   /* number of requests that follow */
+} tstream_hdr_t;
+
+typedef struct {
+    uint32_t op;        /* type in the top 2 bits, id below */
+    uint32_t size;      /* bytes requested (0 for free) */
+} tstream_op_t;
+
+#define TS_ALLOC   0
+#define TS_FREE    1
+#define TS_REALLOC 2
+
+#define TS_ID_BITS 30
+#define TS_MAX_ID  ((1U << TS_ID_BITS) - 1)
+#define TS_OP(type, id) (((uint32_t)(type) << TS_ID_BITS) | (uint32_t)(id))
+#define TS_TYPE(o)  ((int)((o)->op >> TS_ID_BITS))
+#define TS_ID(o)    ((o)->op & TS_MAX_ID)
+
+/* Requests per chunk */
+#define TSTREAM_CHUNK (1 << 16)
+
+/*
+ * The stream reader
+ */
+typedef struct tstream tstream_t;
+
+/* Open a trace and start reading ahead; exits on error */
+tstream_t *tstream_open(char *path);
+
+/* The header of the trace (also filled in for text traces) */
+tstream_hdr_t *tstream_header(tstream_t *ts);
+
+/* Return the next chunk of requests in *ops and its length, or 0 at
+   the end of the trace. The chunk is valid until the next call. */
+int tstream_next(tstream_t *ts, tstream_op_t **ops);
+
+/* Number of calls to tstream_next that had to wait for the disk */
+unsigned long tstream_stalls(tstream_t *ts);
+
+/* Stop reading and free the stream */
+void tstream_close(tstream_t *ts);
+
+/*
+ * Map from the id of each live block to its address and size, so
+ * memory use follows the live set rather than the number of ids
+ */
+typedef struct {
+    uint32_t id;        /* trace id, LIVE_EMPTY if the slot is free */
+    uint32_t size;      /* payload size */
+    char *p;            /* payload address */
+} live_t;
+
+typedef struct {
+    live_t *slots;      /* open addressing with linear probing */
+    size_t mask;        /* number of slots - 1 */
+    size_t n;           /* number of live blocks */
+} livemap_t;
+
+#define LIVE_EMPTY 0xffffffffU
+
+void live_init(livemap_t *map);
+void live_clear(livemap_t *map);
+void live_free(livemap_t *map);
+live_t *live_find(livemap_t *map, uint32_t id);   /* NULL if not live */
+live_t *live_insert(livemap_t *map, uint32_t id); /* NULL if already live */
+void live_reserve(livemap_t *map, size_t n);    /* room for n, no growing */
+void live_remove(livemap_t *map, live_t *e);
+
+#endif /* __TSTREAM_H_ */
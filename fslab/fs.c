@@ -1,7 +1,21 @@
+#define _XOPEN_SOURCE 700   // for pread, pwrite and getopt under -std=c99
+#define _DEFAULT_SOURCE     // and preadv
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
 
 /*****************************************
  *
@@ -11,6 +25,8 @@
  * 
  *****************************************/
 
+// linux/io_uring.h brings in linux/fs.h, whose BLOCK_SIZE isn't ours
+#undef BLOCK_SIZE
 #define BLOCK_SIZE 256
 #define NUM_BLOCKS 2048
 #define NUM_INODES 128
@@ -18,12 +34,49 @@
 int first_inode_block = 3;
 int first_data_block = 35;
 
+// if >= 0, blocks live in this image file rather than in disk/
+int image_fd = -1;
+
+// if not NULL, the image is mapped here and blocks are read in place (-m)
+char * volume_map = NULL;
+
+// print buffer cache statistics at exit (-v)
+int verbose = 0;
+
+#define INODE_BITMAP_BLOCK 1
+#define BLOCK_BITMAP_BLOCK 2
+
+// inode flags
+#define INODE_INDEXED 1   // directory with a hash index at index_ptr
+#define INODE_EXTENTS 2   // blocks mapped by extents, not pointers
+
+// a run of length blocks starting at block start
+typedef struct extent{
+  int start;
+  int length;
+} extent_t;
+
+#define INLINE_EXTENTS 4
+#define EXTENTS_PER_BLOCK (BLOCK_SIZE/sizeof(extent_t))
+#define MAX_EXTENTS (INLINE_EXTENTS + EXTENTS_PER_BLOCK)
+
 typedef struct inode_struct{
   char filename[16];
-  long filesize;
-  int direct_ptrs[8];
-  int indirect_ptr;
-  int doubly_indirect_ptr;
+  int filesize;
+  unsigned short flags;
+  unsigned short index_ptr;   // root block of a directory's hash index
+  union{
+    struct{
+      int direct_ptrs[8];
+      int indirect_ptr;
+      int doubly_indirect_ptr;
+    };
+    struct{                   // if flags has INODE_EXTENTS
+      extent_t extents[INLINE_EXTENTS];
+      int num_extents;
+      int extent_block;       // holds extents past the inline ones
+    };
+  };
 } inode_t;
 
 typedef struct directory_entry{
@@ -32,6 +85,225 @@ typedef struct directory_entry{
   char padding[12];
 } directory_entry_t;
 
+// A directory's hash index is a root block of INDEX_BUCKETS block
+// numbers, each the head of a chain of bucket blocks holding the
+// entries whose names hash to it (0 for an empty chain)
+#define INDEX_BUCKETS (BLOCK_SIZE/sizeof(int))
+#define INDEX_SLOTS 12
+
+typedef struct index_entry{
+  char name[16];
+  int inumber;
+} index_entry_t;
+
+typedef struct index_bucket{
+  int count;       // entries in use
+  int next;        // next bucket block in the chain, or 0
+  index_entry_t entries[INDEX_SLOTS];
+  char padding[8];
+} index_bucket_t;
+
+// one slot of the buffer cache
+typedef struct cache_block{
+  int block_num;   // -1 if the slot is empty
+  int dirty;       // written since it was read, so must be written back
+  int referenced;  // used since the clock hand last passed
+  int pinned;      // written in the running transaction, which must
+                   // commit before the block can go back to the volume
+  int hash_next;   // next slot in the same hash bucket, or -1
+  char data[BLOCK_SIZE];
+} cache_block_t;
+
+#define DEFAULT_CACHE_BLOCKS 64
+
+// Block 0 says where the volume's parts are. A volume may also have a
+// write-ahead log, or journal: a run of journal_blocks blocks whose
+// first is a header, followed by transactions. Each is one or more
+// descriptors listing the blocks that follow them, the blocks
+// themselves, and a commit block whose checksum covers them all.
+typedef struct superblock{
+  int layout[5];        // as made: 1024, then the bitmap, inode and data blocks
+  int journal_start;    // the journal's header block, or 0 if there's none
+  int journal_blocks;
+  char padding[BLOCK_SIZE - 7*sizeof(int)];
+} superblock_t;
+
+#define JOURNAL_MAGIC 0x4a524e4c
+#define JOURNAL_HEADER 0
+#define JOURNAL_DESCRIPTOR 1
+#define JOURNAL_COMMIT 2
+#define JOURNAL_DESC_BLOCKS ((int)((BLOCK_SIZE - 5*sizeof(int))/sizeof(int)))
+// the most metadata blocks one operation writes, besides the pointer
+// blocks of the data it adds: the bitmaps, two inode blocks, two of
+// the directory, its pointer blocks, and an index root and bucket
+#define JOURNAL_OP_BLOCKS 16
+
+typedef struct journal_block{
+  unsigned magic;
+  int type;
+  unsigned sequence;    // the header's is that of the first transaction
+  int count;            // blocks in the transaction
+  unsigned checksum;    // in the commit block
+  int blocks[JOURNAL_DESC_BLOCKS];  // in a descriptor: where its share goes
+} journal_block_t;
+
+#define DEFAULT_JOURNAL_BLOCKS 128
+#define DEFAULT_GROUP_COMMIT 16
+
+// While there is a journal, a block written through the cache is
+// pinned there until the running transaction commits. Each operation
+// (journal_begin ... journal_end) goes whole into a transaction, and a
+// transaction commits after group_commit operations, with one fsync,
+// or sooner if the next operation might not fit in it. It never
+// commits in the middle of an operation.
+int journal_start = 0;       // 0 while there's no journal in use
+int journal_blocks = 0;
+int journal_head = 0;        // where the next transaction goes
+unsigned journal_seq = 0;    // the next transaction's sequence number
+int group_commit = DEFAULT_GROUP_COMMIT;   // operations per commit (-g)
+char * journal_log = NULL;   // journal_blocks blocks, to read or write it
+int * txn_slots = NULL;      // cache slots in the transaction
+int txn_limit = 0;           // the most it can hold
+int txn_len = 0;
+int txn_ops = 0;             // operations finished in it
+int txn_depth = 0;           // operations begun and not yet ended
+int txn_data_written = 0;    // data went to the volume in place
+long journal_commits = 0;
+long journal_logged = 0;     // blocks written to the journal
+long journal_fsyncs = 0;
+long journal_checkpoints = 0;
+
+// the buffer cache; cache_size slots, or no cache at all if 0 (-c)
+int cache_size = DEFAULT_CACHE_BLOCKS;
+cache_block_t * cache = NULL;
+int * cache_buckets = NULL;   // first slot of each hash chain, or -1
+int cache_num_buckets = 0;    // a power of 2
+int cache_hand = 0;           // the clock hand
+long cache_hits = 0;
+long cache_misses = 0;
+long cache_writebacks = 0;
+
+// port_from_105 reads this many blocks of a file ahead of writing (-r)
+#define DEFAULT_READAHEAD 256
+#define MAX_GAP_BLOCKS 4   // most unwanted blocks a preadv reads through
+#define MAX_IOVECS 64
+int readahead_blocks = DEFAULT_READAHEAD;
+long export_blocks = 0;   // blocks read by port_from_105 ...
+long export_reads = 0;    // ... and the reads it took
+
+// the size of each file written by the benchmark (-b)
+#define BENCH_FILE_SIZE 4096
+
+// where alloc_block looks first: just past the last block allocated
+int alloc_goal = 0;
+long alloc_count = 0;     // blocks allocated ...
+long alloc_calls = 0;     // ... by this many calls ...
+long alloc_ns = 0;        // ... the time they took ...
+long alloc_max_ns = 0;    // ... and the longest one
+long block_writes = 0;    // multi-block writes by write_blocks
+
+// Reads that don't depend on each other, such as the blocks under an
+// indirect block, go through an asynchronous engine (-a), which keeps
+// up to AIO_DEPTH of them in flight and hands back each as it lands
+#define AIO_DEPTH 64
+#define AIO_THREADS 8
+#define AIO_SYNC 0      // no engine: each read is done when submitted
+#define AIO_POOL 1      // AIO_THREADS threads doing preadv
+#define AIO_URING 2     // io_uring
+const char * aio_engine_names[] = {"sync", "threads", "io_uring"};
+
+typedef struct aio_op{
+  off_t offset;
+  struct iovec * iov;   // where the data goes, or NULL to use dest
+  int num_iov;
+  char * dest;          // for a single block
+  ssize_t len;          // bytes that the read should return
+  int tag;              // the caller's name for it, given back by aio_wait
+  struct iovec one;     // the iov when there is only dest
+} aio_op_t;
+
+// a finished read
+typedef struct aio_done{
+  int tag;
+  int failed;
+} aio_done_t;
+
+int aio_engine = AIO_URING;   // falls back to AIO_POOL if io_uring fails
+int aio_started = 0;          // set once the engine is set up
+aio_op_t aio_slots[AIO_DEPTH];  // the reads in flight
+int aio_free_slots[AIO_DEPTH];
+int aio_num_free = 0;
+int aio_in_flight = 0;
+aio_op_t * aio_queue = NULL;  // reads waiting for a slot
+int aio_queue_head = 0, aio_queue_len = 0, aio_queue_cap = 0;
+aio_done_t * aio_done = NULL; // finished reads not yet given back
+int aio_done_head = 0, aio_done_len = 0, aio_done_cap = 0;
+long aio_reads = 0;
+int aio_max_in_flight = 0;
+
+// the io_uring: rings shared with the kernel
+int uring_fd = -1;
+unsigned * sq_tail, * sq_mask, * sq_array;
+unsigned * cq_head, * cq_tail, * cq_mask;
+struct io_uring_sqe * sqes;
+struct io_uring_cqe * cqes;
+unsigned uring_unsubmitted = 0;   // sqes queued since the last enter
+
+// the thread pool: slots to read, and slots read, each a ring
+pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t aio_work_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t aio_work_done = PTHREAD_COND_INITIALIZER;
+int aio_work[AIO_DEPTH];
+int aio_work_head = 0, aio_work_len = 0;
+int aio_finished[AIO_DEPTH];
+ssize_t aio_results[AIO_DEPTH];
+int aio_finished_len = 0;
+
+// Caches of name lookups, so that search_path needn't walk the path
+// from the root each time: one maps (directory inum, name) to an inum,
+// or to -1 for a name known not to be there; the other maps whole paths
+#define DCACHE_SIZE 512
+#define PCACHE_SIZE 128
+#define PCACHE_PATH_LEN 128
+
+typedef struct dentry{
+  int dir_inum;     // 0 if the entry is empty (inode 0 is no directory)
+  char name[16];
+  int inumber;      // -1 for a name that isn't in the directory
+} dentry_t;
+
+typedef struct path_entry{
+  unsigned generation;   // the entry is stale unless this is path_generation
+  char path[PCACHE_PATH_LEN];
+  int inumber;
+} path_entry_t;
+
+// A file open for writing. What is appended waits in buf, with no
+// blocks allocated for it, until the buffer fills or the file is
+// closed. Then it all gets blocks at once, in as few runs as the free
+// space allows, and each run is one write_blocks. buf always starts on
+// a block boundary of the file: only closing writes a part block.
+typedef struct open_file{
+  int inum;
+  inode_t inode;    // ahead of the volume's copy until the next flush
+  char * buf;       // write_buffer_blocks blocks
+  long buffered;    // bytes in buf
+} open_file_t;
+
+#define DEFAULT_WRITE_BUFFER 64
+
+// blocks buffered per open file, or 0 to allocate as data is written (-W)
+int write_buffer_blocks = DEFAULT_WRITE_BUFFER;
+
+int name_caches = 1;   // 0 turns both off (-D)
+dentry_t dcache[DCACHE_SIZE];
+path_entry_t pcache[PCACHE_SIZE];
+unsigned path_generation = 1;   // bumped to drop every cached path
+long dcache_hits = 0;
+long dcache_misses = 0;
+long pcache_hits = 0;
+long pcache_misses = 0;
+
 // constructs the native filename for a data block stored on disk
 char * block_filename(int block_num, int include_path){
   int max_filename_len = 32;
@@ -46,8 +318,8 @@ char * block_filename(int block_num, int include_path){
   return filename;
 }
 
-// writes a block to disk, given the block number
-int write_block(int block_num, char * source){
+// writes a block to its own file in disk/
+int write_block_file(int block_num, char * source){
   char * filename = block_filename(block_num, 1);
 
   FILE * fp = fopen(filename, "wb");
@@ -65,8 +337,8 @@ int write_block(int block_num, char * source){
   return 0;
 }
 
-// reads a data block into memory, given the block number
-int read_block(int block_num, char * dest){
+// reads a block from its own file in disk/
+int read_block_file(int block_num, char * dest){
   char * filename = block_filename(block_num, 1);
 
   FILE * fp = fopen(filename, "rb");
@@ -85,167 +357,2980 @@ int read_block(int block_num, char * dest){
   return 0;
 }
 
-// initializes a data block of zero bytes
-int initialize_block(int block_num){
-  char * zeros = (char *) malloc(BLOCK_SIZE);
-  memset(zeros, 0, BLOCK_SIZE);
+// opens a volume stored as one image file of NUM_BLOCKS blocks, so that
+// a block is a single pread or pwrite at block_num * BLOCK_SIZE instead
+// of opening, reading byte by byte and closing a file in disk/
+int open_image(char * path){
+  image_fd = open(path, O_RDWR);
+  if(image_fd < 0){
+    fprintf(stderr,"open() failed to open image %s\n",path);
+    return 1;
+  }
+  return 0;
+}
 
-  char * filename = block_filename(block_num, 1);
-  write_block(block_num, zeros);
-  
-  free(filename);
-  free(zeros);
+// maps the open image so that blocks can be used where they lie, with
+// no copy into a buffer (see get_block). The cache would only hold
+// second copies of mapped blocks, so mapping turns it off. A short
+// image is extended with zeros first, which is what reads past its end
+// return anyway; touching a mapped page past the end would be SIGBUS.
+int map_image(void){
+  struct stat st;
+  off_t size = (off_t)NUM_BLOCKS * BLOCK_SIZE;
+  if(image_fd < 0){
+    fprintf(stderr,"map_image: -m needs an image (-i)\n");
+    return 1;
+  }
+  if(fstat(image_fd, &st) < 0 || (st.st_size < size && ftruncate(image_fd, size) < 0)){
+    fprintf(stderr,"map_image: can't extend the image to %ld bytes\n",(long)size);
+    return 1;
+  }
+  volume_map = mmap(NULL, (size_t)NUM_BLOCKS * BLOCK_SIZE,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+  if(volume_map == MAP_FAILED){
+    volume_map = NULL;
+    fprintf(stderr,"mmap() failed to map the image\n");
+    return 1;
+  }
+  cache_size = 0;
+  return 0;
+}
+
+// writes a block straight to the volume, given the block number
+int write_block_disk(int block_num, char * source){
+  if(block_num < 0 || block_num >= NUM_BLOCKS){
+    fprintf(stderr,"Can't write block %d: NUM_BLOCKS=%d\n",block_num,NUM_BLOCKS);
+    return 1;
+  }
+  if(image_fd < 0){
+    return write_block_file(block_num, source);
+  }
+  if(volume_map){
+    memcpy(volume_map + (size_t)block_num * BLOCK_SIZE, source, BLOCK_SIZE);
+    return 0;
+  }
+
+  if(pwrite(image_fd, source, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE)
+     != BLOCK_SIZE){
+    fprintf(stderr,"pwrite() failed to write block %d in write_block_disk\n",block_num);
+    return 1;
+  }
   return 0;
 }
 
+// reads a block straight from the volume, given the block number
+int read_block_disk(int block_num, char * dest){
+  if(block_num < 0 || block_num >= NUM_BLOCKS){
+    fprintf(stderr,"Can't read block %d: NUM_BLOCKS=%d\n",block_num,NUM_BLOCKS);
+    return 1;
+  }
+  if(image_fd < 0){
+    return read_block_file(block_num, dest);
+  }
+  if(volume_map){
+    memcpy(dest, volume_map + (size_t)block_num * BLOCK_SIZE, BLOCK_SIZE);
+    return 0;
+  }
 
-// writes an inode to disk
-int write_inode(int inumber, inode_t inode){
-  if(inumber >= NUM_INODES){
-    fprintf(stderr,"Can't write inode %d: NUM_INODES=%d\n",inumber,NUM_INODES);
-    return -1;
+  ssize_t n = pread(image_fd, dest, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE);
+  if(n < 0){
+    fprintf(stderr,"pread() failed to read block %d in read_block_disk\n",block_num);
+    return 1;
   }
-  int inodes_per_block = BLOCK_SIZE/sizeof(inode_t);
-  int block_num = 3 + inumber/inodes_per_block;
-  int offset = inumber - (inumber/inodes_per_block*inodes_per_block);
+  // a short image simply ends in blocks that were never written
+  memset(dest + n, 0, BLOCK_SIZE - n);
+  return 0;
+}
 
-  inode_t * block_data = (inode_t *) malloc(BLOCK_SIZE);
+// sets up an empty buffer cache of cache_size slots
+int init_cache(void){
+  cache_num_buckets = 1;
+  while(cache_num_buckets < 2 * cache_size){
+    cache_num_buckets *= 2;
+  }
 
-  int ret = read_block(block_num, (char *)block_data);
-  memcpy(block_data+offset,&inode,sizeof(inode));
-  write_block(block_num, (char *)block_data);
+  cache = (cache_block_t *) malloc(cache_size * sizeof(cache_block_t));
+  cache_buckets = (int *) malloc(cache_num_buckets * sizeof(int));
+  if(!cache || !cache_buckets){
+    fprintf(stderr,"malloc() failed in init_cache\n");
+    return 1;
+  }
 
-  free(block_data);
+  for(int i = 0; i < cache_size; i++){
+    cache[i].block_num = -1;
+    cache[i].dirty = 0;
+    cache[i].referenced = 0;
+    cache[i].pinned = 0;
+    cache[i].hash_next = -1;
+  }
+  for(int i = 0; i < cache_num_buckets; i++){
+    cache_buckets[i] = -1;
+  }
   return 0;
 }
 
-// loads an inode into memory, given an inode number
-int read_inode(int inumber, inode_t * dest){
-  int inodes_per_block = BLOCK_SIZE/sizeof(inode_t);
-  int block_num = 3 + inumber/inodes_per_block;
-  int offset = inumber - (inumber/inodes_per_block*inodes_per_block);
+// returns the hash bucket of a block number
+int cache_bucket(int block_num){
+  return (unsigned) block_num * 2654435761u & (cache_num_buckets - 1);
+}
 
-  inode_t * block_data = (inode_t *) malloc(BLOCK_SIZE);
+// returns the slot holding block_num, or -1 if it isn't cached
+int cache_lookup(int block_num){
+  int slot = cache_buckets[cache_bucket(block_num)];
+  while(slot >= 0 && cache[slot].block_num != block_num){
+    slot = cache[slot].hash_next;
+  }
+  return slot;
+}
 
-  read_block(block_num, (char *)block_data);
-  memcpy(dest,block_data+offset,sizeof(inode_t));
+// hashes len bytes, continuing from hash (FNV-1a). Journal checksums
+// use it as it is, and names through string_hash.
+unsigned fnv_hash(unsigned hash, const char * data, size_t len){
+  for(size_t i = 0; i < len; i++){
+    hash = (hash ^ (unsigned char) data[i]) * 16777619u;
+  }
+  return hash;
+}
 
-  free(block_data);
+// hashes a string of at most len characters, continuing from hash
+unsigned string_hash(unsigned hash, const char * s, size_t len){
+  return fnv_hash(hash, s, strnlen(s, len));
+}
+
+// writes a journal block of type type at block_num with one pwrite
+int journal_write(int block_num, journal_block_t * jb, int type, unsigned sequence){
+  jb->magic = JOURNAL_MAGIC;
+  jb->type = type;
+  jb->sequence = sequence;
+  if(pwrite(image_fd, jb, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE) != BLOCK_SIZE){
+    fprintf(stderr,"pwrite() failed to write journal block %d\n",block_num);
+    return 1;
+  }
   return 0;
 }
 
-// initializes contents of an inode in memory
-void initialize_inode(char * filename, inode_t * inode){
-  strncpy(inode->filename,filename,16);
-  inode->filesize = 0;
-  
-  for(int i = 0; i < 8; i++){
-    inode->direct_ptrs[i] = 0;
+// flushes what has been written to the image to the disk
+int journal_sync(void){
+  journal_fsyncs++;
+  if(fdatasync(image_fd) < 0){
+    fprintf(stderr,"fdatasync() failed on the journal\n");
+    return 1;
   }
-  inode->indirect_ptr = 0;
-  inode->doubly_indirect_ptr = 0;
+  return 0;
 }
 
-// Given a filepath, returns an array of files in that filepath
-// Arg 2 (len) should be the length of the string path
-// Arg 3 should be a location for storing the number of files in the path
-char **parse_path(char *path, size_t len, int *num_dirs){
+// empties the journal: a new header says the next transaction starts
+// right after it with sequence number journal_seq, so whatever is
+// left of older ones will never be replayed
+int journal_reset(void){
+  journal_block_t header;
+  memset(&header, 0, sizeof(header));
+  journal_head = journal_start + 1;
+  return journal_write(journal_start, &header, JOURNAL_HEADER, journal_seq) ||
+    journal_sync();
+}
 
-  // count number of directories in file path (no normalizing) 
-  *num_dirs = 0;
-  for (int i = 0; i < len; i += 1){
-      if (path[i] == '/'){
-	  *num_dirs += 1;
-      }
+// Writes the running transaction to the journal as one write of its
+// descriptors, its blocks and the commit block, then one fsync. The
+// checksum lets replay spot a commit that only partly reached the
+// disk. Data written in place must be on the disk before any commit
+// that points to it, so if there was some, that takes an fsync first.
+// The blocks stay dirty in the cache, now free to go back to the
+// volume at any time. Returns 1 on error.
+int journal_commit(void){
+  if(txn_len == 0){
+    return 0;
+  }
+  int descs = (txn_len + JOURNAL_DESC_BLOCKS - 1) / JOURNAL_DESC_BLOCKS;
+  int need = descs + txn_len + 1;
+  // journal_make_room keeps this from happening
+  if(journal_head + need > journal_start + journal_blocks){
+    fprintf(stderr,"journal_commit: no room in the journal for transaction %u\n",
+            journal_seq);
+    return 1;
+  }
+  if(txn_data_written && journal_sync()){
+    return 1;
   }
 
-  // allocate entries for each word, plus an extra one for NULL termination   
-  char ** dirs = (char **) malloc(sizeof(char *) * (*num_dirs+1));
+  // each descriptor has the whole count, and the next share of the
+  // block numbers
+  char * log = journal_log;
+  memset(log, 0, (size_t)descs * BLOCK_SIZE);
+  for(int i = 0; i < txn_len; i++){
+    journal_block_t * desc = (journal_block_t *)(log + (size_t)(i / JOURNAL_DESC_BLOCKS) * BLOCK_SIZE);
+    desc->magic = JOURNAL_MAGIC;
+    desc->type = JOURNAL_DESCRIPTOR;
+    desc->sequence = journal_seq;
+    desc->count = txn_len;
+    desc->blocks[i % JOURNAL_DESC_BLOCKS] = cache[txn_slots[i]].block_num;
+    memcpy(log + (size_t)(descs + i) * BLOCK_SIZE, cache[txn_slots[i]].data, BLOCK_SIZE);
+  }
+  journal_block_t * commit = (journal_block_t *)(log + (size_t)(descs + txn_len) * BLOCK_SIZE);
+  memset(commit, 0, BLOCK_SIZE);
+  commit->magic = JOURNAL_MAGIC;
+  commit->type = JOURNAL_COMMIT;
+  commit->sequence = journal_seq;
+  commit->count = txn_len;
+  commit->checksum = fnv_hash(2166136261u, log, (size_t)(descs + txn_len) * BLOCK_SIZE);
 
-  char *current_dir = path;
-  int dir_index = 0;
-  for(int i = 0; i <= len; i += 1){
-    if (path[i] == '/' || path[i] == '\0'){
-      // save the current directory, null terminated                           
-      path[i] = '\0';
-      dirs[dir_index] = current_dir;
+  size_t len = (size_t)need * BLOCK_SIZE;
+  if(pwrite(image_fd, log, len, (off_t)journal_head * BLOCK_SIZE) != (ssize_t)len){
+    fprintf(stderr,"pwrite() failed to write transaction %u to the journal\n",journal_seq);
+    return 1;
+  }
+  if(journal_sync()){
+    return 1;
+  }
 
-      dir_index += 1;
-      current_dir = path + i + 1;
-    }
+  for(int i = 0; i < txn_len; i++){
+    cache[txn_slots[i]].pinned = 0;
   }
+  journal_head += need;
+  journal_seq++;
+  journal_commits++;
+  journal_logged += txn_len;
+  txn_len = 0;
+  txn_ops = 0;
+  txn_data_written = 0;
+  return 0;
+}
 
-  return dirs;
+// the most blocks one operation can put in a transaction: its
+// metadata, and the pointer blocks for a write buffer's worth of data
+int journal_op_blocks(void){
+  int blocks = write_buffer_blocks > 0 ? write_buffer_blocks : DEFAULT_WRITE_BUFFER;
+  return JOURNAL_OP_BLOCKS + blocks / (int)(BLOCK_SIZE/sizeof(int)) + 3;
 }
 
+// the most blocks a transaction can hold in a journal of size blocks,
+// after its header, descriptors and commit block
+int journal_capacity(int size){
+  int blocks = size - 2;
+  while(blocks > 0 &&
+        blocks + (blocks + JOURNAL_DESC_BLOCKS - 1) / JOURNAL_DESC_BLOCKS + 2 > size){
+    blocks--;
+  }
+  return blocks;
+}
 
-// Given the block number of a data block containing directory entries, 
-// searches the first max directory entries for the directory entry for 
-// filename. Returns the inum associated with that file if found, else -1
-int search_dir_data_block(int data_block_num, char * filename,
-			  int max_entries){
-  // TODO #1a
+// writes a slot back to the volume if it is dirty
+int cache_write_back(int slot){
+  if(!cache[slot].dirty){
+    return 0;
+  }
+  // the journal must have it before the volume does
+  if(cache[slot].pinned && journal_commit()){
+    return 1;
+  }
+  if(write_block_disk(cache[slot].block_num, cache[slot].data)){
+    return 1;
+  }
+  cache[slot].dirty = 0;
+  cache_writebacks++;
   return 0;
 }
 
+// removes a slot from its hash chain and marks it empty
+void cache_unlink(int slot){
+  int * link = &cache_buckets[cache_bucket(cache[slot].block_num)];
+  while(*link != slot){
+    link = &cache[*link].hash_next;
+  }
+  *link = cache[slot].hash_next;
+  cache[slot].block_num = -1;
+}
 
-// Given the block number of an indirect file block, searches the data blocks
-// pointed to by that indirect block for an entry matching filename.
-// Returns the inum associated with that file if found, else -1
-int search_dir_indirect(int indirect_block_num, char * filename, 
-			int max_entries){
-  // TODO #4a
-  return 0;
+// picks a slot for block_num by CLOCK: the hand skips, and clears, slots
+// used since it last passed them, so hot blocks get a second chance.
+// Pinned slots are skipped too; at most half the cache is ever pinned.
+// The victim is written back if dirty and rehashed under block_num.
+// Returns -1 if the victim couldn't be written back.
+int cache_evict(int block_num){
+  int slot;
+  for(;;){
+    slot = cache_hand;
+    cache_hand = (cache_hand + 1) % cache_size;
+    if(cache[slot].pinned){
+      continue;
+    }
+    if(!cache[slot].referenced){
+      break;
+    }
+    cache[slot].referenced = 0;
+  }
+
+  if(cache[slot].block_num >= 0){
+    if(cache_write_back(slot)){
+      return -1;
+    }
+    cache_unlink(slot);
+  }
+
+  int bucket = cache_bucket(block_num);
+  cache[slot].block_num = block_num;
+  cache[slot].hash_next = cache_buckets[bucket];
+  cache_buckets[bucket] = slot;
+  return slot;
 }
 
-// Given the block number of a doubly-indirect file block, searches the data 
-// blocks pointed to by that indirect block for an entry matching filename.
-// Returns the inum associated with that file if found, else -1
-int search_dir_doubly_indirect(int doubly_indirect_block_num, char * filename, 
-			       int max_entries){
-  // TODO #4b
-  return 0;
+// writes every dirty block back to the volume, in block order so that
+// an image sees sequential writes. With a journal, the running
+// transaction commits first, and the journal is emptied after.
+int flush_cache(void){
+  int ret = 0;
+  if(volume_map &&
+     msync(volume_map, (size_t)NUM_BLOCKS * BLOCK_SIZE, MS_SYNC) < 0){
+    fprintf(stderr,"msync() failed in flush_cache\n");
+    return 1;
+  }
+  if(!cache){
+    return 0;
+  }
+  if(journal_start && journal_commit()){
+    return 1;
+  }
+  for(int b = 0; b < NUM_BLOCKS; b++){
+    int slot = cache_lookup(b);
+    if(slot >= 0 && cache_write_back(slot)){
+      ret = 1;
+    }
+  }
+  if(image_fd >= 0 && fsync(image_fd) < 0){
+    fprintf(stderr,"fsync() failed in flush_cache\n");
+    ret = 1;
+  }
+  // everything in the journal is on the volume now
+  if(journal_start && ret == 0){
+    journal_checkpoints++;
+    ret = journal_reset();
+  }
+  return ret;
 }
 
-// Given inumber of a directory, returns the inumber of a file in that dir
-// Returns -1 if file not found.
-int search_dir(int dir_inum, char * filename){
-  // TODO #1b: implement this assuming that no indirect pointers are used
+// flushes the cache at exit and, with -v, reports how well it and the
+// name caches did
+void close_cache(void){
+  flush_cache();
+  if(verbose && cache){
+    long total = cache_hits + cache_misses;
+    fprintf(stderr,"cache: %d blocks, %ld hits, %ld misses (%.1f%% hits), "
+            "%ld writebacks\n", cache_size, cache_hits, cache_misses,
+            total ? 100.0 * cache_hits / total : 0.0, cache_writebacks);
+  }
+  if(verbose && journal_start){
+    fprintf(stderr,"journal: %ld commits of %ld blocks, %ld checkpoints, %ld fsyncs\n",
+            journal_commits, journal_logged, journal_checkpoints, journal_fsyncs);
+  }
+  if(verbose && export_blocks){
+    fprintf(stderr,"export: %ld blocks in %ld reads\n",export_blocks,export_reads);
+  }
+  if(verbose && aio_started){
+    fprintf(stderr,"aio: %s, %ld reads, up to %d in flight\n",
+            aio_engine_names[aio_engine], aio_reads, aio_max_in_flight);
+  }
+  if(verbose && name_caches){
+    fprintf(stderr,"names: %ld path hits, %ld path misses, "
+            "%ld dentry hits, %ld dentry misses\n",
+            pcache_hits, pcache_misses, dcache_hits, dcache_misses);
+  }
+}
 
-  // TODO #4c: extend this to support the general case
-  return 0;
+// the most blocks a transaction can hold in what is left of the journal
+int journal_room(void){
+  return journal_capacity(journal_start + journal_blocks - journal_head + 1);
 }
 
-// Given an absolute filepath, returns the inode of that file
-// Returns -1 if any file in the path is not found
-int search_path(char * filepath){
-  // Note: implementation currently assumes that the filepath is of the form
-  //       /filename.ext (i.e., that the file you are looking for is in the 
-  //       root directory
+// Makes sure the running transaction can take blocks more and still
+// commit: if it would outgrow txn_limit it commits now, and if it
+// would outgrow the journal, the cache is flushed, which commits it,
+// writes everything home and empties the journal. Only between
+// operations, so nothing pinned is left behind and no operation is
+// split. Returns 1 on error.
+int journal_make_room(int blocks){
+  if(txn_len + blocks > txn_limit && journal_commit()){
+    return 1;
+  }
+  if(txn_len + blocks > journal_room()){
+    return flush_cache();
+  }
+  return 0;
+}
 
-  int num_dirs;
-  char ** dirs = parse_path(filepath, strlen(filepath), &num_dirs);
+// starts an operation that must be in the journal whole. Outside any
+// other, it first makes room for one as big as they get. Returns 1 on
+// error, and then there's no operation.
+int journal_begin(void){
+  if(txn_depth == 0 && journal_start && journal_make_room(journal_op_blocks())){
+    return 1;
+  }
+  txn_depth++;
+  return 0;
+}
 
-  return search_dir(2, dirs[1]);
+// ends an operation; every group_commit of them, the transaction commits
+int journal_end(void){
+  if(--txn_depth > 0 || !journal_start){
+    return 0;
+  }
+  if(++txn_ops >= group_commit){
+    return journal_commit();
+  }
+  return 0;
+}
 
-  // TODO #3: extend this to support the general case
+// pins a slot just written into the running transaction. A write
+// outside any operation is one by itself, so it makes room for itself;
+// inside one, journal_begin left room enough.
+int journal_pin(int slot){
+  if(!journal_start || cache[slot].pinned){
+    return 0;
+  }
+  if(txn_depth == 0 && journal_make_room(1)){
+    return 1;
+  }
+  if(txn_len == txn_limit || txn_len == journal_room()){
+    fprintf(stderr,"journal_pin: an operation outgrew its transaction\n");
+    return 1;
+  }
+  cache[slot].pinned = 1;
+  txn_slots[txn_len++] = slot;
+  return 0;
 }
 
-// Given a filepath, ports the file with that filepath from the 105 filesystem
-// and stores it in the native OS file system with name new_filename
-void port_from_105(char * filepath, char * new_filename){
-  // TODO #2: implement this assuming that the filepath is of the form
-  //          /filename.ext (i.e., that the file you are looking for is 
-  //          in the root directory and that all files/directories are small
-  //          enough to fit in one data_block
+// writes a block to disk, given the block number. With the cache on,
+// the block is only written back when it is evicted or flushed.
+int write_block(int block_num, char * source){
+  if(cache_size == 0){
+    return write_block_disk(block_num, source);
+  }
+  if(!cache && init_cache()){
+    return 1;
+  }
+  if(block_num < 0 || block_num >= NUM_BLOCKS){
+    fprintf(stderr,"Can't write block %d: NUM_BLOCKS=%d\n",block_num,NUM_BLOCKS);
+    return 1;
+  }
+
+  int slot = cache_lookup(block_num);
+  if(slot >= 0){
+    cache_hits++;
+  } else {
+    // the whole block is overwritten, so there's no need to read it
+    cache_misses++;
+    if((slot = cache_evict(block_num)) < 0){
+      return 1;
+    }
+  }
+  memcpy(cache[slot].data, source, BLOCK_SIZE);
+  cache[slot].dirty = 1;
+  cache[slot].referenced = 1;
+  return journal_pin(slot);
+}
 
-  // TODO #5: extend this to support the general case
+// reads a data block into memory, given the block number
+int read_block(int block_num, char * dest){
+  if(cache_size == 0){
+    return read_block_disk(block_num, dest);
+  }
+  if(!cache && init_cache()){
+    return 1;
+  }
+  if(block_num < 0 || block_num >= NUM_BLOCKS){
+    fprintf(stderr,"Can't read block %d: NUM_BLOCKS=%d\n",block_num,NUM_BLOCKS);
+    return 1;
+  }
 
-  return;
+  int slot = cache_lookup(block_num);
+  if(slot >= 0){
+    cache_hits++;
+  } else {
+    cache_misses++;
+    if((slot = cache_evict(block_num)) < 0){
+      return 1;
+    }
+    if(read_block_disk(block_num, cache[slot].data)){
+      // leave the slot empty rather than caching garbage
+      cache_unlink(slot);
+      return 1;
+    }
+  }
+  memcpy(dest, cache[slot].data, BLOCK_SIZE);
+  cache[slot].referenced = 1;
+  return 0;
+}
+
+// returns a read-only pointer to a block: into the mapped image if
+// there is one, else into buf (BLOCK_SIZE bytes), which the block is
+// read into. Returns NULL on error.
+const char * get_block(int block_num, char * buf){
+  if(volume_map && block_num >= 0 && block_num < NUM_BLOCKS){
+    return volume_map + (size_t)block_num * BLOCK_SIZE;
+  }
+  return read_block(block_num, buf) ? NULL : buf;
+}
+
+// reads count consecutive blocks, starting at block_num, into dest.
+// From an image this is one pread; any dirty copies in the cache are
+// written back first, and the blocks aren't cached, so that a large
+// sequential read doesn't flush everything else out of the cache.
+int read_blocks(int block_num, int count, char * dest){
+  if(block_num < 0 || count < 0 || block_num + count > NUM_BLOCKS){
+    fprintf(stderr,"Can't read blocks %d-%d: NUM_BLOCKS=%d\n",
+            block_num,block_num+count-1,NUM_BLOCKS);
+    return 1;
+  }
+  if(volume_map){
+    memcpy(dest, volume_map + (size_t)block_num * BLOCK_SIZE,
+           (size_t)count * BLOCK_SIZE);
+    return 0;
+  }
+  if(image_fd < 0){
+    for(int i = 0; i < count; i++){
+      if(read_block(block_num + i, dest + (size_t)i * BLOCK_SIZE)){
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  for(int i = 0; cache && i < count; i++){
+    int slot = cache_lookup(block_num + i);
+    if(slot >= 0 && cache_write_back(slot)){
+      return 1;
+    }
+  }
+  size_t len = (size_t)count * BLOCK_SIZE;
+  ssize_t n = pread(image_fd, dest, len, (off_t)block_num * BLOCK_SIZE);
+  if(n < 0){
+    fprintf(stderr,"pread() failed to read blocks at %d in read_blocks\n",block_num);
+    return 1;
+  }
+  memset(dest + n, 0, len - n);
+  return 0;
+}
+
+// writes count consecutive blocks, starting at block_num, from src.
+// To an image this is one pwrite. Any copies in the cache are out of
+// date now, so they are dropped rather than written back over it.
+int write_blocks(int block_num, int count, const char * src){
+  if(block_num < 0 || count < 0 || block_num + count > NUM_BLOCKS){
+    fprintf(stderr,"Can't write blocks %d-%d: NUM_BLOCKS=%d\n",
+            block_num,block_num+count-1,NUM_BLOCKS);
+    return 1;
+  }
+  block_writes++;
+  if(volume_map){
+    memcpy(volume_map + (size_t)block_num * BLOCK_SIZE, src,
+           (size_t)count * BLOCK_SIZE);
+    return 0;
+  }
+  if(image_fd < 0){
+    for(int i = 0; i < count; i++){
+      if(write_block(block_num + i, (char *)src + (size_t)i * BLOCK_SIZE)){
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  // a cached copy the running transaction has must stay in it, so it
+  // gets the new data; committing here could split an operation
+  for(int i = 0; cache && i < count; i++){
+    int slot = cache_lookup(block_num + i);
+    if(slot >= 0 && cache[slot].pinned){
+      memcpy(cache[slot].data, src + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+    } else if(slot >= 0){
+      cache[slot].dirty = 0;
+      cache_unlink(slot);
+    }
+  }
+  txn_data_written = 1;
+  size_t len = (size_t)count * BLOCK_SIZE;
+  if(pwrite(image_fd, src, len, (off_t)block_num * BLOCK_SIZE) != (ssize_t)len){
+    fprintf(stderr,"pwrite() failed to write blocks at %d in write_blocks\n",block_num);
+    return 1;
+  }
+  return 0;
+}
+
+// sets up an io_uring of AIO_DEPTH entries by hand, as there may be no
+// liburing. Returns 1 if the kernel won't give us one.
+int uring_init(void){
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  uring_fd = syscall(__NR_io_uring_setup, AIO_DEPTH, &p);
+  if(uring_fd < 0){
+    return 1;
+  }
+
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if(single && cq_len > sq_len){
+    sq_len = cq_len;
+  }
+  char * sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
+  char * cq = single ? sq :
+    mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_CQ_RING);
+  sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              uring_fd, IORING_OFF_SQES);
+  if(sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED){
+    close(uring_fd);
+    uring_fd = -1;
+    return 1;
+  }
+
+  sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + p.sq_off.array);
+  cq_head = (unsigned *)(cq + p.cq_off.head);
+  cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+// a thread of the pool: reads slots off aio_work until the program ends
+void * aio_worker(void * arg){
+  (void) arg;
+  pthread_mutex_lock(&aio_lock);
+  for(;;){
+    while(aio_work_len == 0){
+      pthread_cond_wait(&aio_work_ready, &aio_lock);
+    }
+    int slot = aio_work[aio_work_head];
+    aio_work_head = (aio_work_head + 1) % AIO_DEPTH;
+    aio_work_len--;
+    pthread_mutex_unlock(&aio_lock);
+
+    aio_op_t * op = &aio_slots[slot];
+    ssize_t n = preadv(image_fd, op->iov, op->num_iov, op->offset);
+
+    pthread_mutex_lock(&aio_lock);
+    aio_results[slot] = n;
+    aio_finished[aio_finished_len++] = slot;
+    pthread_cond_signal(&aio_work_done);
+  }
+  return NULL;
+}
+
+// sets up the engine asked for, falling back to the thread pool if
+// there is no io_uring, and to plain reads if there are no threads
+void aio_init(void){
+  aio_started = 1;
+  for(int i = 0; i < AIO_DEPTH; i++){
+    aio_free_slots[i] = AIO_DEPTH - 1 - i;
+  }
+  aio_num_free = AIO_DEPTH;
+
+  if(aio_engine == AIO_URING && uring_init()){
+    aio_engine = AIO_POOL;
+  }
+  if(aio_engine == AIO_POOL){
+    for(int i = 0; i < AIO_THREADS; i++){
+      pthread_t t;
+      if(pthread_create(&t, NULL, aio_worker, NULL)){
+        // the threads already started still share the work
+        if(i == 0){
+          aio_engine = AIO_SYNC;
+        }
+        break;
+      }
+      pthread_detach(t);
+    }
+  }
+}
+
+// hands back a finished read from aio_wait
+void aio_push_done(int tag, int failed){
+  if(aio_done_head + aio_done_len == aio_done_cap){
+    if(aio_done_head > 0){
+      memmove(aio_done, aio_done + aio_done_head, aio_done_len * sizeof(aio_done_t));
+      aio_done_head = 0;
+    } else {
+      aio_done_cap = aio_done_cap ? 2 * aio_done_cap : AIO_DEPTH;
+      aio_done = (aio_done_t *) realloc(aio_done, aio_done_cap * sizeof(aio_done_t));
+      if(!aio_done){
+        fprintf(stderr,"realloc() failed in aio_push_done\n");
+        exit(1);
+      }
+    }
+  }
+  aio_done[aio_done_head + aio_done_len].tag = tag;
+  aio_done[aio_done_head + aio_done_len].failed = failed;
+  aio_done_len++;
+}
+
+// finishes the read in slot, which returned n. Like read_block_disk,
+// a read that runs off the end of a short image gets zeros.
+void aio_finish(int slot, ssize_t n){
+  aio_op_t * op = &aio_slots[slot];
+  if(n >= 0 && n < op->len){
+    for(int i = 0; i < op->num_iov; i++){
+      if((size_t) n < op->iov[i].iov_len){
+        memset((char *) op->iov[i].iov_base + n, 0, op->iov[i].iov_len - n);
+        n = 0;
+      } else {
+        n -= op->iov[i].iov_len;
+      }
+    }
+    n = op->len;
+  }
+  if(n < 0){
+    fprintf(stderr,"read of block %ld failed in aio_finish\n",
+            (long)(op->offset / BLOCK_SIZE));
+  }
+  aio_push_done(op->tag, n < 0);
+  aio_free_slots[aio_num_free++] = slot;
+  aio_in_flight--;
+}
+
+// starts the read in slot
+void aio_start(int slot){
+  aio_op_t * op = &aio_slots[slot];
+  if(!op->iov){
+    op->one.iov_base = op->dest;
+    op->one.iov_len = op->len;
+    op->iov = &op->one;
+    op->num_iov = 1;
+  }
+  aio_in_flight++;
+  if(aio_in_flight > aio_max_in_flight){
+    aio_max_in_flight = aio_in_flight;
+  }
+  aio_reads++;
+
+  if(aio_engine == AIO_URING){
+    // the ring has AIO_DEPTH entries, so there is always room
+    unsigned tail = *sq_tail;
+    unsigned i = tail & *sq_mask;
+    struct io_uring_sqe * sqe = &sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = image_fd;
+    sqe->off = op->offset;
+    sqe->addr = (unsigned long) op->iov;
+    sqe->len = op->num_iov;
+    sqe->user_data = slot;
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring_unsubmitted++;
+  } else if(aio_engine == AIO_POOL){
+    pthread_mutex_lock(&aio_lock);
+    aio_work[(aio_work_head + aio_work_len) % AIO_DEPTH] = slot;
+    aio_work_len++;
+    pthread_cond_signal(&aio_work_ready);
+    pthread_mutex_unlock(&aio_lock);
+  } else {
+    aio_finish(slot, preadv(image_fd, op->iov, op->num_iov, op->offset));
+  }
+}
+
+// waits for at least one read in flight to finish, and finishes all
+// that have. Returns 1 on error.
+int aio_reap(void){
+  if(aio_engine == AIO_URING){
+    int n;
+    do {
+      n = syscall(__NR_io_uring_enter, uring_fd, uring_unsubmitted, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0){
+      fprintf(stderr,"io_uring_enter() failed in aio_reap\n");
+      return 1;
+    }
+    uring_unsubmitted -= n;
+
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++){
+      struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+      aio_finish(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  int finished[AIO_DEPTH];
+  ssize_t results[AIO_DEPTH];
+  pthread_mutex_lock(&aio_lock);
+  while(aio_finished_len == 0){
+    pthread_cond_wait(&aio_work_done, &aio_lock);
+  }
+  int count = aio_finished_len;
+  for(int i = 0; i < count; i++){
+    finished[i] = aio_finished[i];
+    results[i] = aio_results[finished[i]];
+  }
+  aio_finished_len = 0;
+  pthread_mutex_unlock(&aio_lock);
+  for(int i = 0; i < count; i++){
+    aio_finish(finished[i], results[i]);
+  }
+  return 0;
+}
+
+// queues a read of the blocks at block_num into iov, which must stay
+// put until aio_wait hands back tag. Nothing is read until aio_wait,
+// so that everything submitted before it goes to the kernel at once.
+void aio_submitv(int block_num, struct iovec * iov, int num_iov, char * dest,
+                 ssize_t len, int tag){
+  if(!aio_started){
+    aio_init();
+  }
+  if(aio_queue_head + aio_queue_len == aio_queue_cap){
+    if(aio_queue_head > 0){
+      memmove(aio_queue, aio_queue + aio_queue_head, aio_queue_len * sizeof(aio_op_t));
+      aio_queue_head = 0;
+    } else {
+      aio_queue_cap = aio_queue_cap ? 2 * aio_queue_cap : AIO_DEPTH;
+      aio_queue = (aio_op_t *) realloc(aio_queue, aio_queue_cap * sizeof(aio_op_t));
+      if(!aio_queue){
+        fprintf(stderr,"realloc() failed in aio_submitv\n");
+        exit(1);
+      }
+    }
+  }
+  aio_op_t * op = &aio_queue[aio_queue_head + aio_queue_len++];
+  op->offset = (off_t)block_num * BLOCK_SIZE;
+  op->iov = iov;
+  op->num_iov = num_iov;
+  op->dest = dest;
+  op->len = len;
+  op->tag = tag;
+}
+
+// queues a read of one block into dest (see aio_submitv). A block that
+// is in the cache, or that isn't in an image file, is read right away
+// and simply handed back first; reads through the engine bypass the
+// cache, like read_blocks.
+void aio_submit(int block_num, char * dest, int tag){
+  int slot = cache && block_num >= 0 && block_num < NUM_BLOCKS ?
+    cache_lookup(block_num) : -1;
+  if(slot >= 0){
+    cache_hits++;
+    memcpy(dest, cache[slot].data, BLOCK_SIZE);
+    cache[slot].referenced = 1;
+    aio_push_done(tag, 0);
+  } else if(image_fd < 0 || volume_map || block_num < 0 || block_num >= NUM_BLOCKS){
+    aio_push_done(tag, read_block_disk(block_num, dest));
+  } else {
+    aio_submitv(block_num, NULL, 0, dest, BLOCK_SIZE, tag);
+  }
+}
+
+// waits for the next read to finish, in whatever order they do, and
+// sets *tag to its tag. Returns 0 if it read, 1 if it failed, and -1
+// if there is nothing left to wait for.
+int aio_wait(int * tag){
+  while(aio_done_len == 0){
+    while(aio_queue_len > 0 && aio_num_free > 0){
+      int slot = aio_free_slots[--aio_num_free];
+      aio_slots[slot] = aio_queue[aio_queue_head++];
+      aio_queue_len--;
+      aio_start(slot);
+    }
+    if(aio_queue_len == 0){
+      aio_queue_head = 0;
+    }
+    if(aio_done_len > 0){
+      break;
+    }
+    if(aio_in_flight == 0 || aio_reap()){
+      return -1;
+    }
+  }
+  aio_done_t * d = &aio_done[aio_done_head++];
+  if(--aio_done_len == 0){
+    aio_done_head = 0;
+  }
+  *tag = d->tag;
+  return d->failed;
+}
+
+// forgets every read not yet handed back, once those in flight have
+// landed, so that a caller that has what it wanted can free its buffers
+void aio_cancel(void){
+  aio_queue_head = aio_queue_len = 0;
+  while(aio_in_flight > 0 && aio_reap() == 0){
+  }
+  aio_done_head = aio_done_len = 0;
+}
+
+// builds an image file from the blocks in disk/. Blocks that have no
+// file there were never written, so they are left as holes of zeros.
+int import_image(char * path){
+  char block[BLOCK_SIZE];
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    fprintf(stderr,"open() failed to create image %s\n",path);
+    return 1;
+  }
+  if(ftruncate(fd, (off_t)NUM_BLOCKS * BLOCK_SIZE) < 0){
+    fprintf(stderr,"ftruncate() failed on image %s\n",path);
+    close(fd);
+    return 1;
+  }
+
+  int ret = 0;
+  for(int i = 0; i < NUM_BLOCKS && ret == 0; i++){
+    char * filename = block_filename(i, 1);
+    int exists = access(filename, R_OK) == 0;
+    free(filename);
+    if(!exists){
+      continue;
+    }
+    ret = read_block_file(i, block);
+    if(ret == 0 &&
+       pwrite(fd, block, BLOCK_SIZE, (off_t)i * BLOCK_SIZE) != BLOCK_SIZE){
+      fprintf(stderr,"pwrite() failed to write block %d to %s\n",i,path);
+      ret = 1;
+    }
+  }
+
+  if(close(fd) < 0){
+    ret = 1;
+  }
+  return ret;
+}
+
+// initializes a data block of zero bytes
+int initialize_block(int block_num){
+  char * zeros = (char *) malloc(BLOCK_SIZE);
+  memset(zeros, 0, BLOCK_SIZE);
+
+  char * filename = block_filename(block_num, 1);
+  write_block(block_num, zeros);
+  
+  free(filename);
+  free(zeros);
+  return 0;
+}
+
+
+// writes an inode to disk. Returns nonzero on error.
+int write_inode(int inumber, inode_t inode){
+  if(inumber >= NUM_INODES){
+    fprintf(stderr,"Can't write inode %d: NUM_INODES=%d\n",inumber,NUM_INODES);
+    return -1;
+  }
+  int inodes_per_block = BLOCK_SIZE/sizeof(inode_t);
+  int block_num = 3 + inumber/inodes_per_block;
+  int offset = inumber - (inumber/inodes_per_block*inodes_per_block);
+
+  inode_t * block_data = (inode_t *) malloc(BLOCK_SIZE);
+
+  if(read_block(block_num, (char *)block_data)){
+    free(block_data);
+    return 1;
+  }
+  memcpy(block_data+offset,&inode,sizeof(inode));
+  if(write_block(block_num, (char *)block_data)){
+    free(block_data);
+    return 1;
+  }
+
+  free(block_data);
+  return 0;
+}
+
+// returns a read-only pointer to an inode, in place in its block as
+// get_block does (buf is BLOCK_SIZE bytes). Returns NULL on error.
+const inode_t * get_inode(int inumber, char * buf){
+  if(inumber < 0 || inumber >= NUM_INODES){
+    fprintf(stderr,"Can't read inode %d: NUM_INODES=%d\n",inumber,NUM_INODES);
+    return NULL;
+  }
+  int inodes_per_block = BLOCK_SIZE/sizeof(inode_t);
+  int block_num = 3 + inumber/inodes_per_block;
+  int offset = inumber - (inumber/inodes_per_block*inodes_per_block);
+
+  const inode_t * block_data = (const inode_t *) get_block(block_num, buf);
+  if(!block_data){
+    return NULL;
+  }
+  return block_data + offset;
+}
+
+// loads an inode into memory, given an inode number
+int read_inode(int inumber, inode_t * dest){
+  char buf[BLOCK_SIZE];
+  const inode_t * inode = get_inode(inumber, buf);
+  if(!inode){
+    return 1;
+  }
+  memcpy(dest,inode,sizeof(inode_t));
+  return 0;
+}
+
+// initializes contents of an inode in memory
+void initialize_inode(char * filename, inode_t * inode){
+  strncpy(inode->filename,filename,16);
+  inode->filesize = 0;
+  inode->flags = 0;
+  inode->index_ptr = 0;
+  
+  for(int i = 0; i < 8; i++){
+    inode->direct_ptrs[i] = 0;
+  }
+  inode->indirect_ptr = 0;
+  inode->doubly_indirect_ptr = 0;
+}
+
+// Given a filepath, returns an array of files in that filepath
+// Arg 2 (len) should be the length of the string path
+// Arg 3 should be a location for storing the number of files in the path
+char **parse_path(char *path, size_t len, int *num_dirs){
+
+  // count number of directories in file path (no normalizing) 
+  *num_dirs = 0;
+  for (int i = 0; i < len; i += 1){
+      if (path[i] == '/'){
+	  *num_dirs += 1;
+      }
+  }
+
+  // allocate entries for each word, plus an extra one for NULL termination   
+  char ** dirs = (char **) malloc(sizeof(char *) * (*num_dirs+1));
+
+  char *current_dir = path;
+  int dir_index = 0;
+  for(int i = 0; i <= len; i += 1){
+    if (path[i] == '/' || path[i] == '\0'){
+      // save the current directory, null terminated                           
+      path[i] = '\0';
+      dirs[dir_index] = current_dir;
+
+      dir_index += 1;
+      current_dir = path + i + 1;
+    }
+  }
+
+  return dirs;
+}
+
+
+// returns bit i of a bitmap block; bit 0 is the high bit of byte 0
+int bitmap_test(const char * map, int i){
+  return (map[i/8] >> (7 - i%8)) & 1;
+}
+
+// sets bit i of a bitmap block to value
+void bitmap_set(char * map, int i, int value){
+  if(value){
+    map[i/8] |= 1 << (7 - i%8);
+  } else {
+    map[i/8] &= ~(1 << (7 - i%8));
+  }
+}
+
+// returns the first clear bit of a bitmap in [start, end), or -1. The
+// map is read a 64-bit word at a time. Loaded most significant byte
+// first, bit i of the map is bit 63 - i%64 of its word, so the count of
+// leading zeros of the inverted word is the first clear bit in it.
+int bitmap_scan(const char * map, int start, int end){
+  for(int w = start/64; w * 64 < end; w++){
+    uint64_t word;
+    memcpy(&word, map + 8 * w, 8);
+    uint64_t clear = ~be64toh(word);
+    if(w == start/64){
+      clear &= ~(uint64_t)0 >> (start % 64);
+    }
+    if(clear){
+      int i = w * 64 + __builtin_clzll(clear);
+      return i < end ? i : -1;
+    }
+  }
+  return -1;
+}
+
+// returns the first clear bit of a bitmap in [low, high) at or after
+// from, wrapping around to low, or -1 if every bit is set
+int bitmap_find_clear(const char * map, int low, int high, int from){
+  if(from < low || from >= high){
+    from = low;
+  }
+  int i = bitmap_scan(map, from, high);
+  return i >= 0 ? i : bitmap_scan(map, low, from);
+}
+
+// counts an allocation of count blocks that began at start
+void alloc_done(const struct timespec * start, int count){
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long ns = (end.tv_sec - start->tv_sec) * 1000000000L + end.tv_nsec - start->tv_nsec;
+  alloc_calls++;
+  alloc_count += count;
+  alloc_ns += ns;
+  if(ns > alloc_max_ns){
+    alloc_max_ns = ns;
+  }
+}
+
+// allocates a block from the free block bitmap, the first free one at
+// or after goal, so that a file's blocks follow each other. Returns the
+// block number, or -1 if the volume is full. The block is not zeroed.
+int alloc_block_near(int goal){
+  char map[BLOCK_SIZE];
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(read_block(BLOCK_BITMAP_BLOCK, map)){
+    return -1;
+  }
+  int i = bitmap_find_clear(map, first_data_block, NUM_BLOCKS, goal);
+  if(i < 0){
+    fprintf(stderr,"alloc_block: no free blocks\n");
+    return -1;
+  }
+  bitmap_set(map, i, 1);
+  if(write_block(BLOCK_BITMAP_BLOCK, map)){
+    return -1;
+  }
+  alloc_goal = i + 1;
+  alloc_done(&start, 1);
+  return i;
+}
+
+// allocates a zeroed block from the free block bitmap, after the last
+// one allocated. Returns the block number, or -1 if the volume is full.
+int alloc_block(void){
+  int i = alloc_block_near(alloc_goal);
+  if(i < 0 || initialize_block(i)){
+    return -1;
+  }
+  return i;
+}
+
+// allocates an inode from the free inode bitmap. Returns its number,
+// or -1 if there are none left. The inode is not initialized.
+int alloc_inode(void){
+  char map[BLOCK_SIZE];
+  if(read_block(INODE_BITMAP_BLOCK, map)){
+    return -1;
+  }
+  int i = bitmap_find_clear(map, 0, NUM_INODES, 0);
+  if(i < 0){
+    fprintf(stderr,"alloc_inode: no free inodes\n");
+    return -1;
+  }
+  bitmap_set(map, i, 1);
+  return write_block(INODE_BITMAP_BLOCK, map) ? -1 : i;
+}
+
+// returns a block to the free block bitmap. The journal is emptied
+// first, since replaying an old copy of the block after it has been
+// given to something else would overwrite that.
+int free_block(int block_num){
+  char map[BLOCK_SIZE];
+  if((journal_start && flush_cache()) || read_block(BLOCK_BITMAP_BLOCK, map)){
+    return 1;
+  }
+  bitmap_set(map, block_num, 0);
+  return write_block(BLOCK_BITMAP_BLOCK, map);
+}
+
+// allocates a run of consecutive free blocks: the first run of want
+// blocks at or after goal, wrapping around, or failing that the longest
+// run there is. Sets *got to its length and returns its first block, or
+// -1 if the volume is full. The blocks are not zeroed.
+int alloc_run_near(int goal, int want, int * got){
+  char map[BLOCK_SIZE];
+  int best = -1, best_len = 0;
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(read_block(BLOCK_BITMAP_BLOCK, map)){
+    return -1;
+  }
+  if(goal < first_data_block || goal >= NUM_BLOCKS){
+    goal = first_data_block;
+  }
+  // from goal to the end, then from the start back up to goal
+  for(int pass = 0; pass < 2 && best_len < want; pass++){
+    int end = pass ? goal : NUM_BLOCKS;
+    for(int i = pass ? first_data_block : goal; i < end && best_len < want; ){
+      if((i = bitmap_scan(map, i, end)) < 0){
+        break;
+      }
+      int len = 0;
+      while(i + len < NUM_BLOCKS && len < want && !bitmap_test(map, i + len)){
+        len++;
+      }
+      if(len > best_len){
+        best = i;
+        best_len = len;
+      }
+      i += len;
+    }
+  }
+  if(best < 0){
+    fprintf(stderr,"alloc_run: no free blocks\n");
+    return -1;
+  }
+
+  for(int i = 0; i < best_len; i++){
+    bitmap_set(map, best + i, 1);
+  }
+  if(write_block(BLOCK_BITMAP_BLOCK, map)){
+    return -1;
+  }
+  alloc_goal = best + best_len;
+  alloc_done(&start, best_len);
+  *got = best_len;
+  return best;
+}
+
+// allocates a run of consecutive free blocks: the first run of want
+// blocks, or failing that the longest run there is (see alloc_run_near)
+int alloc_run(int want, int * got){
+  return alloc_run_near(first_data_block, want, got);
+}
+
+// returns the chain of a directory's hash index that filename is in
+int index_hash(const char * filename){
+  return string_hash(2166136261u, filename, 16) % INDEX_BUCKETS;
+}
+
+// Given the root block of a directory's hash index, returns the inum
+// of filename, or -1 if it isn't in the directory. Only the root and
+// the chain filename hashes to are read, which is usually one block.
+int index_lookup(int root_block_num, char * filename){
+  char buf[BLOCK_SIZE];
+  const int * root = (const int *) get_block(root_block_num, buf);
+  if(!root){
+    return -1;
+  }
+
+  int b = root[index_hash(filename)];
+  while(b > 0){
+    const index_bucket_t * bucket = (const index_bucket_t *) get_block(b, buf);
+    if(!bucket){
+      return -1;
+    }
+    for(int i = 0; i < bucket->count; i++){
+      if(strncmp(bucket->entries[i].name, filename, 16) == 0){
+        return bucket->entries[i].inumber;
+      }
+    }
+    b = bucket->next;
+  }
+  return -1;
+}
+
+// adds filename to a directory's hash index, in the first bucket of its
+// chain with room or else in a new bucket at the head of the chain
+int index_insert(int root_block_num, char * filename, int inumber){
+  int root[INDEX_BUCKETS];
+  index_bucket_t bucket;
+  int hash = index_hash(filename);
+
+  if(read_block(root_block_num, (char *)root)){
+    return 1;
+  }
+  int b;
+  for(b = root[hash]; b > 0; b = bucket.next){
+    if(read_block(b, (char *)&bucket)){
+      return 1;
+    }
+    if(bucket.count < INDEX_SLOTS){
+      break;
+    }
+  }
+
+  if(b <= 0){
+    if((b = alloc_block()) < 0){
+      return 1;
+    }
+    memset(&bucket, 0, sizeof(bucket));
+    bucket.next = root[hash];
+    root[hash] = b;
+    if(write_block(root_block_num, (char *)root)){
+      return 1;
+    }
+  }
+
+  strncpy(bucket.entries[bucket.count].name, filename, 16);
+  bucket.entries[bucket.count].inumber = inumber;
+  bucket.count++;
+  return write_block(b, (char *)&bucket);
+}
+
+// calls fn on every block of a directory's hash index
+int index_for_each_block(int root_block_num, int (*fn)(int)){
+  int root[INDEX_BUCKETS];
+  index_bucket_t bucket;
+
+  if(read_block(root_block_num, (char *)root)){
+    return 1;
+  }
+  for(int h = 0; h < INDEX_BUCKETS; h++){
+    for(int b = root[h]; b > 0; b = bucket.next){
+      if(read_block(b, (char *)&bucket) || fn(b)){
+        return 1;
+      }
+    }
+  }
+  return fn(root_block_num);
+}
+
+// returns a read-only pointer to extent e of an extent-mapped inode,
+// reading the extent block into buf if need be. NULL on error.
+const extent_t * get_extent(const inode_t * inode, int e, char * buf){
+  if(e < INLINE_EXTENTS){
+    return &inode->extents[e];
+  }
+  const extent_t * more = (const extent_t *) get_block(inode->extent_block, buf);
+  return more ? &more[e - INLINE_EXTENTS] : NULL;
+}
+
+// Given an inode, returns the number of the block holding its nth
+// block of data, or -1 if it can't be read
+int file_block_num(const inode_t * inode, int n){
+  char buf[BLOCK_SIZE];
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  const int * ptrs;
+
+  if(inode->flags & INODE_EXTENTS){
+    for(int e = 0; e < inode->num_extents; e++){
+      const extent_t * ext = get_extent(inode, e, buf);
+      if(!ext){
+        return -1;
+      }
+      if(n < ext->length){
+        return ext->start + n;
+      }
+      n -= ext->length;
+    }
+    return -1;
+  }
+
+  if(n < 8){
+    return inode->direct_ptrs[n];
+  }
+  n -= 8;
+  if(n < ptrs_per_block){
+    ptrs = (const int *) get_block(inode->indirect_ptr, buf);
+    return ptrs ? ptrs[n] : -1;
+  }
+  n -= ptrs_per_block;
+  if(n >= ptrs_per_block * ptrs_per_block){
+    return -1;
+  }
+  ptrs = (const int *) get_block(inode->doubly_indirect_ptr, buf);
+  if(!ptrs){
+    return -1;
+  }
+  ptrs = (const int *) get_block(ptrs[n / ptrs_per_block], buf);
+  return ptrs ? ptrs[n % ptrs_per_block] : -1;
+}
+
+// searches the first max_entries directory entries in a block of them
+// for filename. Returns the inum associated with that file if found,
+// else -1
+int search_entries(const char * block, char * filename, int max_entries){
+  const directory_entry_t * entries = (const directory_entry_t *) block;
+  int entries_per_block = BLOCK_SIZE/sizeof(directory_entry_t);
+  for(int i = 0; i < max_entries && i < entries_per_block; i++){
+    if(strncmp(entries[i].name, filename, 16) == 0){
+      return entries[i].inumber;
+    }
+  }
+  return -1;
+}
+
+// Given the block number of a data block containing directory entries, 
+// searches the first max directory entries for the directory entry for 
+// filename. Returns the inum associated with that file if found, else -1
+int search_dir_data_block(int data_block_num, char * filename,
+			  int max_entries){
+  char buf[BLOCK_SIZE];
+  const char * block = get_block(data_block_num, buf);
+  return block ? search_entries(block, filename, max_entries) : -1;
+}
+
+// Searches count consecutive data blocks of a directory, listed in
+// blocks, for filename; max_entries counts from the first. The reads
+// are all submitted at once, and each block is searched as it lands.
+// Returns the inum associated with that file if found, else -1
+int search_dir_blocks(const int * blocks, int count, char * filename,
+                      int max_entries){
+  int entries_per_block = BLOCK_SIZE/sizeof(directory_entry_t);
+  int inum = -1;
+
+  if(count > (max_entries + entries_per_block - 1)/entries_per_block){
+    count = (max_entries + entries_per_block - 1)/entries_per_block;
+  }
+  // a mapped image has every block in place already
+  if(volume_map){
+    for(int i = 0; i < count && inum < 0; i++){
+      inum = search_dir_data_block(blocks[i], filename,
+                                   max_entries - i * entries_per_block);
+    }
+    return inum;
+  }
+
+  char * data = (char *) malloc((size_t)(count > 0 ? count : 1) * BLOCK_SIZE);
+  if(!data){
+    return -1;
+  }
+  for(int i = 0; i < count; i++){
+    aio_submit(blocks[i], data + (size_t)i * BLOCK_SIZE, i);
+  }
+  for(int pending = count; pending > 0 && inum < 0; pending--){
+    int i, failed = aio_wait(&i);
+    if(failed < 0){
+      break;
+    }
+    if(!failed){
+      inum = search_entries(data + (size_t)i * BLOCK_SIZE, filename,
+                            max_entries - i * entries_per_block);
+    }
+  }
+  aio_cancel();
+  free(data);
+  return inum;
+}
+
+// Given the block number of an indirect file block, searches the data blocks
+// pointed to by that indirect block for an entry matching filename.
+// Returns the inum associated with that file if found, else -1
+int search_dir_indirect(int indirect_block_num, char * filename, 
+			int max_entries){
+  char buf[BLOCK_SIZE];
+  const int * ptrs = (const int *) get_block(indirect_block_num, buf);
+  if(!ptrs){
+    return -1;
+  }
+  return search_dir_blocks(ptrs, BLOCK_SIZE/sizeof(int), filename, max_entries);
+}
+
+// Given the block number of a doubly-indirect file block, searches the data 
+// blocks pointed to by that indirect block for an entry matching filename.
+// All the indirect blocks are read at once, and as each lands, the reads
+// of its data blocks are submitted, so the disk is never waiting on one
+// indirect block while the others could be read.
+// Returns the inum associated with that file if found, else -1
+int search_dir_doubly_indirect(int doubly_indirect_block_num, char * filename, 
+			       int max_entries){
+  char buf[BLOCK_SIZE];
+  const int * ptrs = (const int *) get_block(doubly_indirect_block_num, buf);
+  if(!ptrs){
+    return -1;
+  }
+
+  int entries_per_block = BLOCK_SIZE/sizeof(directory_entry_t);
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  int entries_per_indirect = ptrs_per_block * entries_per_block;
+  int num_indirect = (max_entries + entries_per_indirect - 1)/entries_per_indirect;
+  if(num_indirect > ptrs_per_block){
+    num_indirect = ptrs_per_block;
+  }
+  if(volume_map){
+    int inum = -1;
+    for(int i = 0; i < num_indirect && inum < 0; i++){
+      inum = search_dir_indirect(ptrs[i], filename,
+                                 max_entries - i * entries_per_indirect);
+    }
+    return inum;
+  }
+
+  // tag i < num_indirect is indirect block i, then num_indirect + i *
+  // ptrs_per_block + k is the kth data block under it
+  char * data = (char *)
+    malloc((size_t)(num_indirect > 0 ? num_indirect : 1) * (1 + ptrs_per_block) * BLOCK_SIZE);
+  if(!data){
+    return -1;
+  }
+  for(int i = 0; i < num_indirect; i++){
+    aio_submit(ptrs[i], data + (size_t)i * BLOCK_SIZE, i);
+  }
+
+  int inum = -1;
+  for(int pending = num_indirect; pending > 0 && inum < 0; pending--){
+    int tag, failed = aio_wait(&tag);
+    if(failed < 0){
+      break;
+    }
+    if(failed){
+      continue;
+    }
+    if(tag < num_indirect){
+      const int * children = (const int *)(data + (size_t)tag * BLOCK_SIZE);
+      int left = max_entries - tag * entries_per_indirect;
+      for(int k = 0; k < ptrs_per_block && k * entries_per_block < left; k++){
+        int child = num_indirect + tag * ptrs_per_block + k;
+        aio_submit(children[k], data + (size_t)child * BLOCK_SIZE, child);
+        pending++;
+      }
+    } else {
+      int n = tag - num_indirect;   // the nth data block of the lot
+      inum = search_entries(data + (size_t)tag * BLOCK_SIZE, filename,
+                            max_entries - n * entries_per_block);
+    }
+  }
+  aio_cancel();
+  free(data);
+  return inum;
+}
+
+// Given inumber of a directory, returns the inumber of a file in that dir
+// Returns -1 if file not found.
+int search_dir(int dir_inum, char * filename){
+  char buf[BLOCK_SIZE];
+  const inode_t * dir = get_inode(dir_inum, buf);
+  if(!dir){
+    return -1;
+  }
+
+  if(dir->flags & INODE_INDEXED){
+    return index_lookup(dir->index_ptr, filename);
+  }
+
+  int entries_per_block = BLOCK_SIZE/sizeof(directory_entry_t);
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  int max_entries = dir->filesize/sizeof(directory_entry_t);
+  int inum = -1;
+
+  if(dir->flags & INODE_EXTENTS){
+    for(int n = 0; max_entries > 0 && inum < 0; n++){
+      inum = search_dir_data_block(file_block_num(dir, n), filename, max_entries);
+      max_entries -= entries_per_block;
+    }
+    return inum;
+  }
+
+  inum = search_dir_blocks(dir->direct_ptrs, 8, filename, max_entries);
+  max_entries -= 8 * entries_per_block;
+  if(max_entries > 0 && inum < 0){
+    inum = search_dir_indirect(dir->indirect_ptr, filename, max_entries);
+    max_entries -= ptrs_per_block * entries_per_block;
+  }
+  if(max_entries > 0 && inum < 0){
+    inum = search_dir_doubly_indirect(dir->doubly_indirect_ptr, filename,
+                                      max_entries);
+  }
+  return inum;
+}
+
+
+// returns the dentry cache slot for a name in a directory
+dentry_t * dcache_slot(int dir_inum, const char * name){
+  unsigned hash = string_hash(2166136261u ^ dir_inum, name, 16);
+  return &dcache[hash % DCACHE_SIZE];
+}
+
+// Given inumber of a directory, returns the inumber of a file in that
+// dir, or -1 if it isn't there, from the dentry cache when possible.
+// Each slot holds one name; a new name simply replaces the old one.
+int lookup_name(int dir_inum, char * filename){
+  if(!name_caches){
+    return search_dir(dir_inum, filename);
+  }
+
+  dentry_t * d = dcache_slot(dir_inum, filename);
+  if(d->dir_inum == dir_inum && strncmp(d->name, filename, 16) == 0){
+    dcache_hits++;
+    return d->inumber;
+  }
+  dcache_misses++;
+
+  int inum = search_dir(dir_inum, filename);
+  d->dir_inum = dir_inum;
+  strncpy(d->name, filename, 16);
+  d->inumber = inum;
+  return inum;
+}
+
+// Forgets what the name caches know about filename in a directory.
+// Anything that adds, removes or renames a directory entry must call
+// this, since a cached miss for a name that now exists, or a cached
+// path through it, would otherwise be served from the cache.
+void invalidate_name(int dir_inum, char * filename){
+  dentry_t * d = dcache_slot(dir_inum, filename);
+  if(d->dir_inum == dir_inum && strncmp(d->name, filename, 16) == 0){
+    d->dir_inum = 0;
+  }
+  path_generation++;
+}
+
+// Given an absolute filepath, returns the inode of that file
+// Returns -1 if any file in the path is not found
+int search_path(char * filepath){
+  path_entry_t * p = NULL;
+  size_t len = strlen(filepath);
+
+  // a path seen before needs no walk at all
+  if(name_caches && len < PCACHE_PATH_LEN){
+    p = &pcache[string_hash(2166136261u, filepath, len) % PCACHE_SIZE];
+    if(p->generation == path_generation && strcmp(p->path, filepath) == 0){
+      pcache_hits++;
+      return p->inumber;
+    }
+    pcache_misses++;
+    // parse_path cuts filepath up, so keep it now
+    memcpy(p->path, filepath, len + 1);
+    p->generation = 0;
+  }
+
+  int num_dirs;
+  char ** dirs = parse_path(filepath, len, &num_dirs);
+
+  // dirs[0] is the empty name before the leading '/', i.e. the root
+  int inum = 2;
+  for(int i = 1; i <= num_dirs && inum >= 0; i++){
+    // empty names come from "//" or a trailing '/'
+    if(dirs[i][0] != '\0'){
+      inum = lookup_name(inum, dirs[i]);
+    }
+  }
+
+  free(dirs);
+  if(p){
+    p->inumber = inum;
+    p->generation = path_generation;
+  }
+  return inum;
+}
+
+// writes all len bytes of data to fd
+int write_all(int fd, const char * data, size_t len){
+  while(len > 0){
+    ssize_t n = write(fd, data, len);
+    if(n < 0){
+      return 1;
+    }
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// returns a malloc'd array of the block numbers of a file's data, in
+// order, and sets *num_blocks to its length. Each indirect block is
+// read only once. Returns NULL on error.
+int * file_block_map(const inode_t * inode, int * num_blocks){
+  char buf[BLOCK_SIZE];
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  int n = (inode->filesize + BLOCK_SIZE - 1)/BLOCK_SIZE;
+  int i = 0;
+
+  int * map = (int *) malloc((n > 0 ? n : 1) * sizeof(int));
+  if(!map){
+    return NULL;
+  }
+
+  if(inode->flags & INODE_EXTENTS){
+    for(int e = 0; e < inode->num_extents && i < n; e++){
+      const extent_t * ext = get_extent(inode, e, buf);
+      for(int k = 0; ext && k < ext->length && i < n; k++){
+        map[i++] = ext->start + k;
+      }
+    }
+  } else {
+    for(; i < n && i < 8; i++){
+      map[i] = inode->direct_ptrs[i];
+    }
+    const int * ptrs = i < n ? (const int *) get_block(inode->indirect_ptr, buf) : NULL;
+    for(int k = 0; ptrs && k < ptrs_per_block && i < n; k++){
+      map[i++] = ptrs[k];
+    }
+    const int * dptrs = i < n ? (const int *) get_block(inode->doubly_indirect_ptr, buf) : NULL;
+    if(dptrs){
+      // read all the indirect blocks needed at once
+      int first = i;
+      int num_indirect = (n - i + ptrs_per_block - 1)/ptrs_per_block;
+      int * blocks = (int *) malloc((size_t)num_indirect * BLOCK_SIZE);
+      if(!blocks){
+        free(map);
+        return NULL;
+      }
+      for(int d = 0; d < num_indirect; d++){
+        aio_submit(dptrs[d], (char *)(blocks + d * ptrs_per_block), d);
+      }
+      for(int pending = num_indirect; pending > 0; pending--){
+        int d, failed = aio_wait(&d);
+        if(failed < 0){
+          break;
+        }
+        int at = first + d * ptrs_per_block;
+        for(int k = 0; !failed && k < ptrs_per_block && at + k < n; k++){
+          map[at + k] = blocks[d * ptrs_per_block + k];
+          i++;
+        }
+      }
+      aio_cancel();
+      free(blocks);
+    }
+  }
+
+  for(int k = 0; k < i; k++){
+    if(map[k] <= 0 || map[k] >= NUM_BLOCKS){
+      i = -1;
+      break;
+    }
+  }
+  if(i < n){
+    free(map);
+    return NULL;
+  }
+  *num_blocks = n;
+  return map;
+}
+
+// reads the count blocks listed in blocks into dest, in that order.
+// From an image, each stretch of ascending blocks is one preadv. The
+// stretch carries on across gaps of up to MAX_GAP_BLOCKS, such as the
+// indirect blocks between runs of a file's data, which are read into
+// a scratch buffer: a few unwanted blocks cost less than a syscall.
+// The stretches are all submitted to the engine together.
+int read_block_map(const int * blocks, int count, char * dest){
+  // what lands here is never looked at, so reads can share it
+  static char gap[MAX_GAP_BLOCKS * BLOCK_SIZE];
+
+  if(image_fd < 0 || volume_map){
+    for(int i = 0; i < count; ){
+      int k = 1;
+      while(i + k < count && blocks[i + k] == blocks[i] + k){
+        k++;
+      }
+      if(read_blocks(blocks[i], k, dest + (size_t)i * BLOCK_SIZE)){
+        return 1;
+      }
+      export_reads++;
+      i += k;
+    }
+    return 0;
+  }
+
+  // a block adds at most a gap and itself
+  struct iovec * iov = (struct iovec *) malloc((size_t)2 * count * sizeof(struct iovec));
+  if(!iov){
+    return 1;
+  }
+  int used = 0;       // iovs taken by the stretches so far
+  int stretches = 0;
+  for(int i = 0; i < count; ){
+    int first = blocks[i];
+    int next = first;   // the block after the last one in the stretch
+    int num_iov = 0;
+    struct iovec * v = iov + used;
+    do {
+      if(blocks[i] > next){
+        v[num_iov].iov_base = gap;
+        v[num_iov].iov_len = (size_t)(blocks[i] - next) * BLOCK_SIZE;
+        num_iov++;
+      }
+      char * to = dest + (size_t)i * BLOCK_SIZE;
+      if(num_iov > 0 && blocks[i] == next &&
+         (char *)v[num_iov-1].iov_base + v[num_iov-1].iov_len == to){
+        v[num_iov-1].iov_len += BLOCK_SIZE;
+      } else {
+        v[num_iov].iov_base = to;
+        v[num_iov].iov_len = BLOCK_SIZE;
+        num_iov++;
+      }
+      // the volume must see any newer copy in the cache
+      int slot = cache ? cache_lookup(blocks[i]) : -1;
+      if(slot >= 0 && cache_write_back(slot)){
+        aio_cancel();
+        free(iov);
+        return 1;
+      }
+      next = blocks[i] + 1;
+      i++;
+    } while(i < count && blocks[i] >= next &&
+            blocks[i] - next <= MAX_GAP_BLOCKS && num_iov + 2 <= MAX_IOVECS);
+
+    aio_submitv(first, v, num_iov, NULL, (ssize_t)(next - first) * BLOCK_SIZE, first);
+    used += num_iov;
+    stretches++;
+  }
+
+  int ret = 0;
+  for(; stretches > 0; stretches--){
+    int first, failed = aio_wait(&first);
+    if(failed){
+      fprintf(stderr,"can't read the blocks from %d in read_block_map\n",first);
+      ret = 1;
+      break;
+    }
+    export_reads++;
+  }
+  aio_cancel();
+  free(iov);
+  return ret;
+}
+
+// tells the kernel that the blocks listed will be read soon, so that
+// it can read them in while the current window is written out
+void advise_blocks(const int * blocks, int count){
+  if(image_fd < 0 || volume_map || count <= 0){
+    return;
+  }
+  for(int i = 0; i < count; ){
+    int k = 1;
+    while(i + k < count && blocks[i + k] == blocks[i] + k){
+      k++;
+    }
+    posix_fadvise(image_fd, (off_t)blocks[i] * BLOCK_SIZE,
+                  (off_t)k * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+    i += k;
+  }
+}
+
+// Given a filepath, ports the file with that filepath from the 105 filesystem
+// and stores it in the native OS file system with name new_filename.
+// The whole block map is worked out first. The data then goes through
+// a buffer readahead_blocks long: each window is read with as few
+// preadvs as the layout allows, while the next one is being read ahead,
+// and written with one write. A mapped image is written straight from
+// the mapping instead, one write per run of contiguous blocks.
+void port_from_105(char * filepath, char * new_filename){
+  inode_t inode;
+  int num_blocks;
+
+  int inum = search_path(filepath);
+  if(inum < 0 || read_inode(inum, &inode)){
+    fprintf(stderr,"port_from_105: can't find %s\n",filepath);
+    return;
+  }
+  int * map = file_block_map(&inode, &num_blocks);
+  if(!map){
+    fprintf(stderr,"port_from_105: can't map the blocks of %s\n",filepath);
+    return;
+  }
+  char * out = (char *) malloc((size_t)readahead_blocks * BLOCK_SIZE);
+  int fd = open(new_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(!out || fd < 0){
+    fprintf(stderr,"can't create %s in port_from_105\n",new_filename);
+    free(map);
+    free(out);
+    return;
+  }
+
+  long remaining = inode.filesize;
+  for(int n = 0; n < num_blocks; n += readahead_blocks){
+    int count = num_blocks - n;
+    if(count > readahead_blocks){
+      count = readahead_blocks;
+    }
+    int ahead = num_blocks - n - count;
+    advise_blocks(map + n + count, ahead < readahead_blocks ? ahead : readahead_blocks);
+
+    long len = (long)count * BLOCK_SIZE;
+    if(len > remaining){
+      len = remaining;
+    }
+    remaining -= len;
+    export_blocks += count;
+
+    int failed = 0;
+    if(volume_map){
+      for(int i = 0; i < count && !failed; ){
+        int k = 1;
+        while(i + k < count && map[n + i + k] == map[n + i] + k){
+          k++;
+        }
+        long run = (long)k * BLOCK_SIZE < len ? (long)k * BLOCK_SIZE : len;
+        failed = write_all(fd, volume_map + (size_t)map[n + i] * BLOCK_SIZE, run);
+        len -= run;
+        i += k;
+      }
+    } else {
+      failed = read_block_map(map + n, count, out) || write_all(fd, out, len);
+    }
+    if(failed){
+      fprintf(stderr,"port_from_105: can't copy block %d of %s\n",n,filepath);
+      break;
+    }
+  }
+
+  close(fd);
+  free(out);
+  free(map);
+}
+
+
+// the bitmap that mark_block_used fills in
+char * marked_blocks;
+
+int mark_block_used(int block_num){
+  if(block_num > 0 && block_num < NUM_BLOCKS){
+    bitmap_set(marked_blocks, block_num, 1);
+  }
+  return 0;
+}
+
+// marks every block that belongs to a file in map: its data, the
+// indirect blocks that lead to them, and its hash index if it has one
+int mark_file_blocks(const inode_t * inode, char * map){
+  char buf[BLOCK_SIZE];
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  int num_blocks = (inode->filesize + BLOCK_SIZE - 1)/BLOCK_SIZE;
+
+  marked_blocks = map;
+  for(int n = 0; n < num_blocks; n++){
+    mark_block_used(file_block_num(inode, n));
+  }
+  if(inode->flags & INODE_EXTENTS){
+    if(inode->num_extents > INLINE_EXTENTS){
+      mark_block_used(inode->extent_block);
+    }
+  } else if(num_blocks > 8){
+    mark_block_used(inode->indirect_ptr);
+  }
+  if(!(inode->flags & INODE_EXTENTS) && num_blocks > 8 + ptrs_per_block){
+    const int * ptrs = (const int *) get_block(inode->doubly_indirect_ptr, buf);
+    if(!ptrs){
+      return 1;
+    }
+    mark_block_used(inode->doubly_indirect_ptr);
+    for(int k = 0; k * ptrs_per_block < num_blocks - 8 - ptrs_per_block; k++){
+      mark_block_used(ptrs[k]);
+    }
+  }
+  if(inode->flags & INODE_INDEXED){
+    return index_for_each_block(inode->index_ptr, mark_block_used);
+  }
+  return 0;
+}
+
+// recomputes the free block bitmap from the inodes in use. The bitmap
+// on a volume can't be trusted to allocate from until this has run:
+// the one handed out marks the last blocks of image.jpg free. It may
+// free blocks, so like free_block, it empties the journal first.
+int rebuild_bitmaps(void){
+  char inodes[BLOCK_SIZE];
+  char blocks[BLOCK_SIZE];
+  superblock_t super;
+  inode_t inode;
+
+  if((journal_start && flush_cache()) || read_block(INODE_BITMAP_BLOCK, inodes) ||
+     read_block(0, (char *)&super)){
+    return 1;
+  }
+  memset(blocks, 0, BLOCK_SIZE);
+  for(int i = 0; i < first_data_block; i++){
+    bitmap_set(blocks, i, 1);
+  }
+  for(int i = 0; super.journal_start > 0 && i < super.journal_blocks; i++){
+    bitmap_set(blocks, super.journal_start + i, 1);
+  }
+  for(int i = 0; i < NUM_INODES; i++){
+    if(bitmap_test(inodes, i) &&
+       (read_inode(i, &inode) || mark_file_blocks(&inode, blocks))){
+      return 1;
+    }
+  }
+  return write_block(BLOCK_BITMAP_BLOCK, blocks);
+}
+
+// builds a hash index for the directory at path, replacing any it had
+int build_index(char * path){
+  char buf[BLOCK_SIZE];
+  inode_t dir;
+
+  int inum = search_path(path);
+  if(inum < 0 || read_inode(inum, &dir)){
+    fprintf(stderr,"build_index: can't find %s\n",path);
+    return 1;
+  }
+  if(dir.flags & INODE_INDEXED){
+    index_for_each_block(dir.index_ptr, free_block);
+    dir.flags &= ~INODE_INDEXED;
+  }
+
+  int root = alloc_block();
+  if(root < 0){
+    return 1;
+  }
+  int entries_per_block = BLOCK_SIZE/sizeof(directory_entry_t);
+  int num_entries = dir.filesize/sizeof(directory_entry_t);
+  for(int n = 0; n * entries_per_block < num_entries; n++){
+    const directory_entry_t * entries =
+      (const directory_entry_t *) get_block(file_block_num(&dir, n), buf);
+    if(!entries){
+      return 1;
+    }
+    for(int i = 0; i < entries_per_block && n * entries_per_block + i < num_entries; i++){
+      if(index_insert(root, (char *) entries[i].name, entries[i].inumber)){
+        return 1;
+      }
+    }
+  }
+
+  dir.flags |= INODE_INDEXED;
+  dir.index_ptr = root;
+  write_inode(inum, dir);
+  if(verbose){
+    fprintf(stderr,"indexed inode %d: %d entries\n",inum,num_entries);
+  }
+  return 0;
+}
+
+// appends a run to the extents of new, merging it into the last
+// extent if it follows on. Returns 1 if there are already MAX_EXTENTS.
+int add_extent(inode_t * new, extent_t * more, int start, int length){
+  extent_t * last = NULL;
+  if(new->num_extents > 0){
+    int e = new->num_extents - 1;
+    last = e < INLINE_EXTENTS ? &new->extents[e] : &more[e - INLINE_EXTENTS];
+  }
+  if(last && last->start + last->length == start){
+    last->length += length;
+    return 0;
+  }
+  if(new->num_extents == MAX_EXTENTS){
+    return 1;
+  }
+
+  int e = new->num_extents++;
+  extent_t * ext = e < INLINE_EXTENTS ? &new->extents[e] : &more[e - INLINE_EXTENTS];
+  ext->start = start;
+  ext->length = length;
+  return 0;
+}
+
+// rewrites the file at path to be extent-mapped. If its blocks already
+// form at most MAX_EXTENTS runs they stay where they are; otherwise the
+// data is copied into runs as long as the free space allows. Blocks the
+// file no longer uses (such as its indirect blocks) are freed by
+// rebuilding the bitmap.
+int convert_to_extents(char * path){
+  char buf[BLOCK_SIZE];
+  extent_t more[EXTENTS_PER_BLOCK];
+  inode_t old, new;
+
+  int inum = search_path(path);
+  if(inum < 0 || read_inode(inum, &old)){
+    fprintf(stderr,"convert_to_extents: can't find %s\n",path);
+    return 1;
+  }
+  if(old.flags & INODE_EXTENTS){
+    return 0;
+  }
+
+  new = old;
+  new.flags |= INODE_EXTENTS;
+  memset(new.extents, 0, sizeof(new.extents));
+  new.num_extents = 0;
+  new.extent_block = 0;
+  memset(more, 0, sizeof(more));
+
+  // first try to describe the blocks where they are
+  int num_blocks = (old.filesize + BLOCK_SIZE - 1)/BLOCK_SIZE;
+  int n;
+  for(n = 0; n < num_blocks; n++){
+    int b = file_block_num(&old, n);
+    if(b <= 0){
+      return 1;
+    }
+    if(add_extent(&new, more, b, 1)){
+      break;
+    }
+  }
+
+  // too fragmented: copy the data into new runs
+  if(n < num_blocks){
+    new.num_extents = 0;
+    memset(more, 0, sizeof(more));
+    for(n = 0; n < num_blocks; ){
+      int len;
+      int start = alloc_run(num_blocks - n, &len);
+      if(start < 0 || add_extent(&new, more, start, len)){
+        fprintf(stderr,"convert_to_extents: no room to copy %s into %d extents\n",
+                path,(int)MAX_EXTENTS);
+        rebuild_bitmaps();
+        return 1;
+      }
+      for(int i = 0; i < len; i++, n++){
+        if(read_block(file_block_num(&old, n), buf) ||
+           write_block(start + i, buf)){
+          return 1;
+        }
+      }
+    }
+  }
+
+  if(new.num_extents > INLINE_EXTENTS){
+    if((new.extent_block = alloc_block()) < 0 ||
+       write_block(new.extent_block, (char *)more)){
+      return 1;
+    }
+  }
+
+  write_inode(inum, new);
+  if(verbose){
+    fprintf(stderr,"converted inode %d: %d blocks in %d extents\n",
+            inum,num_blocks,new.num_extents);
+  }
+  return rebuild_bitmaps();
+}
+
+
+// sets entry i of the pointer block *ptr_block to value, allocating
+// the pointer block first, near goal, if *ptr_block is 0
+int set_ptr(int * ptr_block, int i, int value, int goal){
+  int ptrs[BLOCK_SIZE/sizeof(int)];
+  if(*ptr_block <= 0){
+    if((*ptr_block = alloc_block_near(goal)) < 0){
+      return 1;
+    }
+    memset(ptrs, 0, BLOCK_SIZE);
+  } else if(read_block(*ptr_block, (char *)ptrs)){
+    return 1;
+  }
+  ptrs[i] = value;
+  return write_block(*ptr_block, (char *)ptrs);
+}
+
+// makes block_num the nth block of a file that has n blocks, with
+// whatever indirect blocks or extents that takes. Only the pointer
+// blocks are written; the caller writes the inode. Returns 1 on error.
+int set_file_block(inode_t * inode, int n, int block_num){
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+
+  if(inode->flags & INODE_EXTENTS){
+    extent_t more[EXTENTS_PER_BLOCK];
+    memset(more, 0, sizeof(more));
+    if(inode->num_extents > INLINE_EXTENTS &&
+       read_block(inode->extent_block, (char *)more)){
+      return 1;
+    }
+    int had = inode->num_extents;
+    if(add_extent(inode, more, block_num, 1)){
+      fprintf(stderr,"set_file_block: file %.16s has %d extents already\n",
+              inode->filename,(int)MAX_EXTENTS);
+      return 1;
+    }
+    if(inode->num_extents <= INLINE_EXTENTS){
+      return 0;
+    }
+    if(had == INLINE_EXTENTS && inode->num_extents > INLINE_EXTENTS &&
+       (inode->extent_block = alloc_block_near(block_num)) < 0){
+      return 1;
+    }
+    return write_block(inode->extent_block, (char *)more);
+  }
+
+  if(n < 8){
+    inode->direct_ptrs[n] = block_num;
+    return 0;
+  }
+  n -= 8;
+  if(n < ptrs_per_block){
+    return set_ptr(&inode->indirect_ptr, n, block_num, block_num);
+  }
+  n -= ptrs_per_block;
+  if(n >= ptrs_per_block * ptrs_per_block){
+    fprintf(stderr,"set_file_block: file %.16s is as big as it can be\n",
+            inode->filename);
+    return 1;
+  }
+
+  int indirect = 0;
+  if(inode->doubly_indirect_ptr > 0){
+    int dptrs[BLOCK_SIZE/sizeof(int)];
+    if(read_block(inode->doubly_indirect_ptr, (char *)dptrs)){
+      return 1;
+    }
+    indirect = dptrs[n / ptrs_per_block];
+  }
+  int old = indirect;
+  if(set_ptr(&indirect, n % ptrs_per_block, block_num, block_num)){
+    return 1;
+  }
+  if(indirect != old){
+    return set_ptr(&inode->doubly_indirect_ptr, n / ptrs_per_block, indirect, indirect);
+  }
+  return 0;
+}
+
+// appends len bytes of data to file inum, whose inode is in memory,
+// and writes the inode. New blocks go right after the file's last one
+// when they can. Unless the data is metadata, such as directory
+// entries, it goes to the volume in place rather than into the
+// journal, if there is one. Returns 1 on error.
+int append_data(int inum, inode_t * inode, const char * data, long len,
+                int metadata){
+  char buf[BLOCK_SIZE];
+  int goal = alloc_goal;
+  if(inode->filesize > 0){
+    goal = file_block_num(inode, (inode->filesize - 1)/BLOCK_SIZE) + 1;
+  }
+
+  while(len > 0){
+    int n = inode->filesize / BLOCK_SIZE;
+    int offset = inode->filesize % BLOCK_SIZE;
+    int chunk = len < BLOCK_SIZE - offset ? len : BLOCK_SIZE - offset;
+    int b;
+    if(offset == 0){
+      if((b = alloc_block_near(goal)) < 0 || set_file_block(inode, n, b)){
+        return 1;
+      }
+      memset(buf, 0, BLOCK_SIZE);
+    } else if((b = file_block_num(inode, n)) < 0 || read_block(b, buf)){
+      return 1;
+    }
+    memcpy(buf + offset, data, chunk);
+    if(metadata || !journal_start ? write_block(b, buf) : write_blocks(b, 1, buf)){
+      return 1;
+    }
+    goal = b + 1;
+    inode->filesize += chunk;
+    data += chunk;
+    len -= chunk;
+  }
+  return write_inode(inum, *inode);
+}
+
+// adds an entry for inum named name to directory dir_inum, and to its
+// hash index if it has one
+int add_dir_entry(int dir_inum, char * name, int inum){
+  directory_entry_t entry;
+  inode_t dir;
+
+  if(read_inode(dir_inum, &dir)){
+    return 1;
+  }
+  memset(&entry, 0, sizeof(entry));
+  strncpy(entry.name, name, 16);
+  entry.inumber = inum;
+  invalidate_name(dir_inum, name);
+  if(append_data(dir_inum, &dir, (char *)&entry, sizeof(entry), 1)){
+    return 1;
+  }
+  if(dir.flags & INODE_INDEXED){
+    return index_insert(dir.index_ptr, name, inum);
+  }
+  return 0;
+}
+
+// Given an absolute filepath that doesn't exist yet, returns the
+// inumber of the directory it would be in, and copies its last name
+// into name (17 bytes). Returns -1 if there's no such directory, or
+// filepath exists or can't be a name.
+int lookup_parent(char * filepath, char * name){
+  size_t len = strlen(filepath);
+  char * path = (char *) malloc(len + 2);
+  strcpy(path, filepath);
+  while(len > 1 && path[len-1] == '/'){
+    path[--len] = '\0';
+  }
+
+  char * slash = strrchr(path, '/');
+  if(!slash || strlen(slash + 1) == 0 || strlen(slash + 1) > 16){
+    fprintf(stderr,"%s is not a path to a new file\n",filepath);
+    free(path);
+    return -1;
+  }
+  strcpy(name, slash + 1);
+  if(slash == path){
+    slash++;   // the parent is the root
+  }
+  *slash = '\0';
+  int dir_inum = search_path(path);
+  free(path);
+
+  if(dir_inum < 0){
+    fprintf(stderr,"no directory to hold %s\n",filepath);
+    return -1;
+  }
+  if(lookup_name(dir_inum, name) >= 0){
+    fprintf(stderr,"%s already exists\n",filepath);
+    return -1;
+  }
+  return dir_inum;
+}
+
+// makes an empty file named name in directory dir_inum and sets
+// *inode to it. Returns its inumber, or -1 on error.
+int create_file(int dir_inum, char * name, inode_t * inode){
+  if(journal_begin()){
+    return -1;
+  }
+  int inum = alloc_inode();
+  if(inum >= 0){
+    initialize_inode(name, inode);
+    if(write_inode(inum, *inode) || add_dir_entry(dir_inum, name, inum)){
+      inum = -1;
+    }
+  }
+  return journal_end() || inum < 0 ? -1 : inum;
+}
+
+// makes an empty file at filepath and opens it for writing. Returns
+// NULL on error.
+open_file_t * file_create(char * filepath){
+  char name[17];
+  int dir_inum = lookup_parent(filepath, name);
+  if(dir_inum < 0){
+    return NULL;
+  }
+  open_file_t * f = (open_file_t *) malloc(sizeof(open_file_t));
+  char * buf = (char *) malloc((size_t)(write_buffer_blocks > 0 ? write_buffer_blocks : 1)
+                               * BLOCK_SIZE);
+  if(!f || !buf || (f->inum = create_file(dir_inum, name, &f->inode)) < 0){
+    free(f);
+    free(buf);
+    return NULL;
+  }
+  f->buf = buf;
+  f->buffered = 0;
+  return f;
+}
+
+// gives blocks to the data buffered for an open file and writes it:
+// the whole blocks, or with all, the part block at the end too. The
+// runs start after the file's last block if there is room there.
+// Returns 1 on error, with the file and the volume as they were.
+int file_flush(open_file_t * f, int all){
+  int ptrs_per_block = BLOCK_SIZE/sizeof(int);
+  char undo[5][BLOCK_SIZE];
+  int undo_num[5];
+  int undos = 0;
+  int count = (all ? f->buffered + BLOCK_SIZE - 1 : f->buffered) / BLOCK_SIZE;
+  long bytes = (long)count * BLOCK_SIZE;
+  if(count == 0){
+    return 0;
+  }
+  if(bytes > f->buffered){
+    memset(f->buf + f->buffered, 0, bytes - f->buffered);
+    bytes = f->buffered;
+  }
+
+  if(journal_begin()){
+    return 1;
+  }
+  int ret = 0;
+  int n = f->inode.filesize / BLOCK_SIZE;   // the file's first new block
+  int goal = n > 0 ? file_block_num(&f->inode, n - 1) + 1 : alloc_goal;
+
+  // Keep what a failure would have to put back: the block bitmap, and
+  // the pointer blocks the file has that adding blocks may change.
+  // Pointer blocks allocated here are freed with the bitmap.
+  inode_t inode = f->inode;
+  undo_num[undos++] = BLOCK_BITMAP_BLOCK;
+  if(inode.flags & INODE_EXTENTS){
+    if(inode.num_extents > INLINE_EXTENTS){
+      undo_num[undos++] = inode.extent_block;
+    }
+  } else {
+    if(inode.indirect_ptr > 0){
+      undo_num[undos++] = inode.indirect_ptr;
+    }
+    if(inode.doubly_indirect_ptr > 0){
+      undo_num[undos++] = inode.doubly_indirect_ptr;
+    }
+  }
+  for(int i = 0; i < undos; i++){
+    if(read_block(undo_num[i], undo[i])){
+      undos = i;
+      ret = 1;
+    }
+  }
+  if(ret == 0 && !(inode.flags & INODE_EXTENTS) && inode.doubly_indirect_ptr > 0 &&
+     n >= 8 + ptrs_per_block){
+    int indirect = ((int *)undo[undos - 1])[(n - 8 - ptrs_per_block) / ptrs_per_block];
+    if(indirect > 0){
+      undo_num[undos] = indirect;
+      ret = read_block(indirect, undo[undos]);
+      undos += ret == 0;
+    }
+  }
+
+  for(int done = 0; done < count && ret == 0; ){
+    int got;
+    int start = alloc_run_near(goal, count - done, &got);
+    if(start < 0){
+      ret = 1;
+      break;
+    }
+    for(int i = 0; i < got && ret == 0; i++){
+      ret = set_file_block(&f->inode, n + done + i, start + i);
+    }
+    ret = ret || write_blocks(start, got, f->buf + (size_t)done * BLOCK_SIZE);
+    done += got;
+    goal = start + got;
+  }
+
+  if(ret == 0){
+    f->inode.filesize += bytes;
+    ret = write_inode(f->inum, f->inode);
+  }
+  if(ret == 0){
+    f->buffered -= bytes;
+    memmove(f->buf, f->buf + bytes, f->buffered);
+  } else {
+    f->inode = inode;
+    for(int i = 0; i < undos; i++){
+      write_block(undo_num[i], undo[i]);
+    }
+  }
+  return journal_end() || ret;
+}
+
+// appends len bytes of data to an open file. Returns 1 on error.
+int file_append(open_file_t * f, const char * data, long len){
+  // unbuffered, the data goes in operations of DEFAULT_WRITE_BUFFER
+  // blocks at most, so that each fits in a transaction
+  long most = (long)DEFAULT_WRITE_BUFFER * BLOCK_SIZE;
+  while(write_buffer_blocks == 0 && len > 0){
+    long chunk = len < most ? len : most;
+    if(journal_begin()){
+      return 1;
+    }
+    int ret = append_data(f->inum, &f->inode, data, chunk, 0);
+    if(journal_end() || ret){
+      return 1;
+    }
+    data += chunk;
+    len -= chunk;
+  }
+  long size = (long)write_buffer_blocks * BLOCK_SIZE;
+  while(len > 0){
+    long chunk = len < size - f->buffered ? len : size - f->buffered;
+    memcpy(f->buf + f->buffered, data, chunk);
+    f->buffered += chunk;
+    data += chunk;
+    len -= chunk;
+    if(f->buffered == size && file_flush(f, 0)){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// writes out what is left of an open file and closes it. Returns 1 on
+// error.
+int file_close(open_file_t * f){
+  int ret = file_flush(f, 1);
+  free(f->buf);
+  free(f);
+  return ret;
+}
+
+// writes len bytes of data to a new file at filepath. Returns 1 on error.
+int write_file(char * filepath, const char * data, long len){
+  open_file_t * f = file_create(filepath);
+  if(!f){
+    return 1;
+  }
+  int ret = file_append(f, data, len);
+  return file_close(f) || ret;
+}
+
+// Given the name of a file in the native OS file system, ports it to
+// the 105 filesystem as a new file at filepath. Returns 1 on error.
+int port_to_105(char * filename, char * filepath){
+  char buf[16 * BLOCK_SIZE];
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr,"can't open %s in port_to_105\n",filename);
+    return 1;
+  }
+  open_file_t * f = file_create(filepath);
+  if(!f){
+    close(fd);
+    return 1;
+  }
+
+  int ret = 0;
+  ssize_t n;
+  while(ret == 0 && (n = read(fd, buf, sizeof(buf))) != 0){
+    if(n < 0){
+      fprintf(stderr,"can't read %s in port_to_105\n",filename);
+      ret = 1;
+    } else {
+      ret = file_append(f, buf, n);
+    }
+  }
+  close(fd);
+  return file_close(f) || ret;
+}
+
+// makes a new, empty directory at path, holding only . and ..
+// Returns 1 on error.
+int make_dir(char * path){
+  char name[17];
+  int parent = lookup_parent(path, name);
+  if(parent < 0){
+    return 1;
+  }
+  inode_t inode;
+  if(journal_begin()){
+    return 1;
+  }
+  int inum = create_file(parent, name, &inode);
+  int ret = inum < 0 || add_dir_entry(inum, ".", inum) ||
+    add_dir_entry(inum, "..", parent);
+  return journal_end() || ret;
+}
+
+// writes count files of size bytes each into a new directory, /bench
+// (or /bench1, ...). The files are all open at once and appended to in
+// turn, chunk bytes at a time, as by that many programs writing at
+// once. Reports the write throughput, counting the flush to the volume
+// at the end, how long allocations took, and how fragmented the files
+// came out: the runs of contiguous blocks they are in. With a journal,
+// it reports how many commits and fsyncs the metadata took.
+int write_benchmark(int count, int size, int chunk){
+  char dir[32];
+  char path[64];
+  struct timespec start, end;
+
+  for(int i = 0; ; i++){
+    sprintf(dir, i ? "/bench%d" : "/bench", i);
+    strcpy(path, dir);
+    if(search_path(path) < 0){
+      break;
+    }
+  }
+  if(chunk <= 0 || chunk > size){
+    chunk = size > 0 ? size : 1;
+  }
+  char * data = (char *) malloc(chunk);
+  open_file_t ** files = (open_file_t **) malloc(count * sizeof(open_file_t *));
+  if(!data || !files){
+    return 1;
+  }
+  for(int i = 0; i < chunk; i++){
+    data[i] = (char) i;
+  }
+
+  long before = alloc_count, before_calls = alloc_calls, before_ns = alloc_ns;
+  long before_writes = block_writes;
+  long before_commits = journal_commits, before_logged = journal_logged;
+  long before_fsyncs = journal_fsyncs;
+  alloc_max_ns = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  strcpy(path, dir);
+  int opened = 0;
+  int failed = make_dir(path);
+  for(; !failed && opened < count; opened++){
+    sprintf(path, "%s/f%d", dir, opened);
+    if(!(files[opened] = file_create(path))){
+      failed = 1;
+      break;
+    }
+  }
+  for(long pos = 0; !failed && pos < size; pos += chunk){
+    long len = size - pos < chunk ? size - pos : chunk;
+    for(int i = 0; i < opened && !failed; i++){
+      failed = file_append(files[i], data, len);
+    }
+  }
+  for(int i = 0; i < opened; i++){
+    failed |= file_close(files[i]);
+  }
+  flush_cache();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  free(data);
+  free(files);
+
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  long allocs = alloc_count - before;
+  long calls = alloc_calls - before_calls;
+  long runs = 0;
+  long written = 0;   // what reached the files, not what was buffered
+  for(int f = 0; f < opened; f++){
+    inode_t inode;
+    int num_blocks;
+    sprintf(path, "%s/f%d", dir, f);
+    int inum = search_path(path);
+    int * map = inum >= 0 && read_inode(inum, &inode) == 0 ?
+      file_block_map(&inode, &num_blocks) : NULL;
+    written += map ? inode.filesize : 0;
+    for(int k = 0; map && k < num_blocks; k++){
+      runs += k == 0 || map[k] != map[k-1] + 1;
+    }
+    free(map);
+  }
+
+  printf("bench: %d files of %d bytes, %d at a time, %d block buffers, in %s\n",
+         opened, size, chunk, write_buffer_blocks, dir);
+  printf("write: %ld bytes in %.3f s: %.2f MB/s, %ld multi-block writes\n",
+         written, secs, secs > 0 ? written / secs / 1e6 : 0.0,
+         block_writes - before_writes);
+  printf("alloc: %ld blocks in %ld calls, %.0f ns mean, %ld ns max\n", allocs,
+         calls, calls ? (double)(alloc_ns - before_ns) / calls : 0.0, alloc_max_ns);
+  printf("layout: %.2f runs per file\n", opened ? (double) runs / opened : 0.0);
+  if(journal_start){
+    printf("journal: %ld commits of up to %d operations, %ld blocks logged, "
+           "%ld fsyncs, %.0f files/s\n", journal_commits - before_commits,
+           group_commit, journal_logged - before_logged,
+           journal_fsyncs - before_fsyncs, secs > 0 ? opened / secs : 0.0);
+  }
+  return failed;
+}
+
+// Replays the journal, if the volume has one: each transaction that
+// committed whole is written where it belongs, in order, which redoes
+// whatever a crash kept from reaching the volume. The journal is then
+// used from here on, if there's an image (without -m). Returns 1 on
+// error, or if the cache or the journal can't hold a whole operation.
+int journal_mount(void){
+  superblock_t super;
+  journal_block_t header;
+
+  if(image_fd < 0){
+    return 0;
+  }
+  if(read_block_disk(0, (char *)&super)){
+    return 1;
+  }
+  if(super.journal_start <= 0){
+    return 0;
+  }
+  int start = super.journal_start;
+  int end = start + super.journal_blocks;
+  if(end > NUM_BLOCKS || read_block_disk(start, (char *)&header) ||
+     header.magic != JOURNAL_MAGIC || header.type != JOURNAL_HEADER){
+    fprintf(stderr,"journal_mount: no journal header at block %d\n",start);
+    return 1;
+  }
+  char * log = (char *) malloc((size_t)super.journal_blocks * BLOCK_SIZE);
+  if(!log){
+    fprintf(stderr,"malloc() failed in journal_mount\n");
+    return 1;
+  }
+
+  unsigned seq = header.sequence;
+  int replayed = 0;
+  for(int pos = start + 1; pos + 3 <= end; ){
+    journal_block_t * desc = (journal_block_t *) log;
+    if(pread(image_fd, log, BLOCK_SIZE, (off_t)pos * BLOCK_SIZE) != BLOCK_SIZE ||
+       desc->magic != JOURNAL_MAGIC || desc->type != JOURNAL_DESCRIPTOR ||
+       desc->sequence != seq || desc->count <= 0 || desc->count > end - pos){
+      break;
+    }
+    int count = desc->count;
+    int descs = (count + JOURNAL_DESC_BLOCKS - 1) / JOURNAL_DESC_BLOCKS;
+    if(pos + descs + count + 1 > end){
+      break;
+    }
+    size_t len = (size_t)(descs + count) * BLOCK_SIZE;
+    journal_block_t * commit = (journal_block_t *)(log + len);
+    if(pread(image_fd, log + BLOCK_SIZE, len, (off_t)(pos + 1) * BLOCK_SIZE) != (ssize_t)len ||
+       commit->magic != JOURNAL_MAGIC || commit->type != JOURNAL_COMMIT ||
+       commit->sequence != seq ||
+       commit->checksum != fnv_hash(2166136261u, log, len)){
+      break;
+    }
+    int i = 0;
+    for(; i < count; i++){
+      desc = (journal_block_t *)(log + (size_t)(i / JOURNAL_DESC_BLOCKS) * BLOCK_SIZE);
+      int b = desc->blocks[i % JOURNAL_DESC_BLOCKS];
+      if(b <= 0 || b >= NUM_BLOCKS || (b >= start && b < end) ||
+         write_block_disk(b, log + (size_t)(descs + i) * BLOCK_SIZE)){
+        fprintf(stderr,"journal_mount: can't replay block %d of transaction %u\n",b,seq);
+        break;
+      }
+    }
+    if(i < count){
+      free(log);
+      return 1;
+    }
+    replayed++;
+    seq++;
+    pos += descs + count + 1;
+  }
+
+  journal_start = start;
+  journal_blocks = super.journal_blocks;
+  journal_seq = seq;
+  if(replayed){
+    if(verbose){
+      fprintf(stderr,"journal: replayed %d transactions\n",replayed);
+    }
+    if(journal_sync() || journal_reset()){
+      return 1;
+    }
+  }
+  journal_head = start + 1;
+
+  if(volume_map){
+    fprintf(stderr,"journal_mount: the journal can't be used with -m\n");
+    journal_start = 0;
+    free(log);
+    return 0;
+  }
+  // no more than half the cache is pinned, and every operation must
+  // fit in a transaction whole
+  int op = journal_op_blocks();
+  if(cache_size / 2 < op){
+    fprintf(stderr,"journal_mount: an operation may write %d blocks, so the "
+            "journal needs a cache of %d blocks or more (-c)\n",op,2*op);
+    free(log);
+    return 1;
+  }
+  txn_limit = journal_capacity(journal_blocks);
+  if(txn_limit < op){
+    fprintf(stderr,"journal_mount: an operation may write %d blocks, more than "
+            "the journal's %d blocks can hold (-W)\n",op,journal_blocks);
+    free(log);
+    return 1;
+  }
+  if(txn_limit > cache_size / 2){
+    txn_limit = cache_size / 2;
+  }
+  txn_slots = (int *) malloc(txn_limit * sizeof(int));
+  if(!txn_slots){
+    fprintf(stderr,"malloc() failed in journal_mount\n");
+    free(log);
+    return 1;
+  }
+  journal_log = log;
+  return 0;
+}
+
+// gives the volume a journal of blocks blocks, in one run. It is used
+// from the next time the volume is mounted. Returns 1 on error.
+int create_journal(int blocks){
+  superblock_t super;
+  journal_block_t header;
+
+  if(image_fd < 0){
+    fprintf(stderr,"create_journal: needs an image (-i)\n");
+    return 1;
+  }
+  if(read_block(0, (char *)&super)){
+    return 1;
+  }
+  if(super.journal_start > 0){
+    fprintf(stderr,"create_journal: there is a journal at block %d already\n",
+            super.journal_start);
+    return 1;
+  }
+  // the biggest operation's transaction must fit after the header
+  int min = 1;
+  while(journal_capacity(min) < journal_op_blocks()){
+    min++;
+  }
+  if(blocks < min){
+    fprintf(stderr,"create_journal: a journal needs %d blocks or more\n",min);
+    return 1;
+  }
+  int got;
+  int start = alloc_run(blocks, &got);
+  if(start < 0 || got < blocks){
+    fprintf(stderr,"create_journal: no run of %d free blocks\n",blocks);
+    return 1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  if(journal_write(start, &header, JOURNAL_HEADER, 0) || journal_sync()){
+    return 1;
+  }
+  super.journal_start = start;
+  super.journal_blocks = blocks;
+  if(verbose){
+    fprintf(stderr,"journal: blocks %d-%d\n",start,start+blocks-1);
+  }
+  return write_block(0, (char *)&super);
+}
+
+
+void usage(char * prog){
+  fprintf(stderr,"Usage: %s [-Dmv] [-a engine] [-c blocks] [-r blocks] [-i image] [-I image]\n"
+          "          [-d dir]... [-w file:path]... [-x dir]... [-e file]...\n"
+          "          [-W blocks] [-b files[:bytes[:chunk]]] [-J blocks] [-g ops]\n",prog);
+  fprintf(stderr,"  -a engine read independent blocks with io_uring (the default),\n"
+          "            threads or sync\n");
+  fprintf(stderr,"  -b n[:s[:c]] write n files of s bytes (default %d) into /bench,\n"
+          "            c bytes to each in turn, report the speed and exit\n",
+          BENCH_FILE_SIZE);
+  fprintf(stderr,"  -c blocks cache this many blocks (default %d, 0 for none)\n",
+          DEFAULT_CACHE_BLOCKS);
+  fprintf(stderr,"  -d dir    make directory dir and exit\n");
+  fprintf(stderr,"  -D        don't cache name lookups\n");
+  fprintf(stderr,"  -e file   map file by extents instead of pointers and exit\n");
+  fprintf(stderr,"  -g ops    commit the journal every ops operations (default %d,\n"
+          "            1 to commit each one alone)\n",DEFAULT_GROUP_COMMIT);
+  fprintf(stderr,"  -i image  use the volume in image instead of disk/\n");
+  fprintf(stderr,"  -I image  build image from the blocks in disk/ and exit\n");
+  fprintf(stderr,"  -J blocks give the image a journal of this many blocks and exit\n");
+  fprintf(stderr,"  -m        map the image (-i) and read blocks in place\n");
+  fprintf(stderr,"  -r blocks read files this far ahead when exporting (default %d)\n",
+          DEFAULT_READAHEAD);
+  fprintf(stderr,"  -v        report buffer cache hits and misses at exit\n");
+  fprintf(stderr,"  -w f:path copy native file f into the volume at path and exit\n");
+  fprintf(stderr,"  -W blocks buffer this much of each file written before allocating\n"
+          "            (default %d, 0 to allocate as written)\n",DEFAULT_WRITE_BUFFER);
+  fprintf(stderr,"  -x dir    build a hash index for directory dir and exit\n");
 }
 
 
 int main(int argc, char ** argv){
+  int c;
+  int map = 0;
+  char ** index_dirs = (char **) malloc(argc * sizeof(char *));
+  int num_index_dirs = 0;
+  char ** extent_files = (char **) malloc(argc * sizeof(char *));
+  int num_extent_files = 0;
+  char ** new_dirs = (char **) malloc(argc * sizeof(char *));
+  int num_new_dirs = 0;
+  char ** new_files = (char **) malloc(argc * sizeof(char *));
+  int num_new_files = 0;
+  int bench_files = 0;
+  int bench_size = BENCH_FILE_SIZE;
+  int bench_chunk = 0;
+  int new_journal = 0;
+  while((c = getopt(argc, argv, "a:b:c:d:De:g:i:I:J:mr:vw:W:x:h")) != -1){
+    switch(c){
+    case 'a':
+      for(aio_engine = AIO_URING; aio_engine >= 0; aio_engine--){
+        if(strcmp(optarg, aio_engine_names[aio_engine]) == 0 ||
+           (aio_engine == AIO_URING && strcmp(optarg, "uring") == 0)){
+          break;
+        }
+      }
+      if(aio_engine < 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'b':
+      if(sscanf(optarg, "%d:%d:%d", &bench_files, &bench_size, &bench_chunk) < 1 ||
+         bench_files <= 0 || bench_size < 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'c':
+      cache_size = atoi(optarg);
+      if(cache_size < 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'd':
+      new_dirs[num_new_dirs++] = optarg;
+      break;
+    case 'D':
+      name_caches = 0;
+      break;
+    case 'e':
+      extent_files[num_extent_files++] = optarg;
+      break;
+    case 'g':
+      group_commit = atoi(optarg);
+      if(group_commit <= 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'J':
+      new_journal = atoi(optarg);
+      if(new_journal <= 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'm':
+      map = 1;
+      break;
+    case 'r':
+      readahead_blocks = atoi(optarg);
+      if(readahead_blocks <= 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'w':
+      if(!strchr(optarg, ':')){
+        usage(argv[0]);
+        return 1;
+      }
+      new_files[num_new_files++] = optarg;
+      break;
+    case 'W':
+      write_buffer_blocks = atoi(optarg);
+      if(write_buffer_blocks < 0){
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'x':
+      index_dirs[num_index_dirs++] = optarg;
+      break;
+    case 'i':
+      if(open_image(optarg)){
+        return 1;
+      }
+      break;
+    case 'I':
+      return import_image(optarg);
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(map && map_image()){
+    return 1;
+  }
+  if(journal_mount()){
+    return 1;
+  }
+
+  // dirty blocks in the cache reach the volume at exit
+  atexit(close_cache);
+
+  // make the journal, or the directories and files, indexes and extent
+  // maps asked for, and stop
+  if(num_new_dirs > 0 || num_new_files > 0 || num_index_dirs > 0 ||
+     num_extent_files > 0 || bench_files > 0 || new_journal > 0){
+    if(rebuild_bitmaps()){
+      return 1;
+    }
+    if(new_journal > 0){
+      return create_journal(new_journal);
+    }
+    for(int i = 0; i < num_new_dirs; i++){
+      if(make_dir(new_dirs[i])){
+        return 1;
+      }
+    }
+    for(int i = 0; i < num_new_files; i++){
+      char * path = strchr(new_files[i], ':');
+      *path++ = '\0';
+      if(port_to_105(new_files[i], path)){
+        return 1;
+      }
+    }
+    for(int i = 0; i < num_index_dirs; i++){
+      if(build_index(index_dirs[i])){
+        return 1;
+      }
+    }
+    for(int i = 0; i < num_extent_files; i++){
+      if(convert_to_extents(extent_files[i])){
+        return 1;
+      }
+    }
+    if(bench_files > 0){
+      return write_benchmark(bench_files, bench_size, bench_chunk);
+    }
+    return 0;
+  }
+  free(index_dirs);
+  free(extent_files);
+  free(new_dirs);
+  free(new_files);
+
   // allocate string on heap to ensure writeability
   char * file_path_105 = (char *) malloc(128);
 